@@ -12,12 +12,26 @@
 
 
 // include
+#ifdef __linux__
+#define _GNU_SOURCE
+#include<sched.h>
+#endif
 #include<stdio.h>
 #include<stdlib.h>
 #include<math.h>
 #include<string.h>
 #include<pthread.h>
 #include<time.h>
+#include<limits.h>
+#include<float.h>
+#include<errno.h>
+#include<stdatomic.h>
+#ifdef __linux__
+#include<unistd.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+#include<sys/mman.h>
+#endif
 
 // graphics
 #ifndef NOGRAPHICS
@@ -32,12 +46,37 @@
 // delay time
 #define DELAY 50000
 
+// what drawBoids() shows, -v. dots draws an o in every cell holding a
+// boid, density draws how many boids are in each cell
+#define VIEWDOTS 0
+#define VIEWDENSITY 1
+
+// glyphs for the density view, from an empty cell to one holding 64 or
+// more boids, each step doubles the count
+#define DENSITYGLYPHS " .:+*#%@"
+#define DENSITYLEVELS 8
+
 // default population size, number of boids
 #define POPSIZE 50
 
 // maximum screen size, both height and width
 #define SCREENSIZE 100
 
+// shapes -d gives the starting flock
+#define INITUNIFORM 0
+#define INITCLUSTER 1
+#define INITCLUSTERS 2
+#define INITSHEET 3
+#define INITLINE 4
+
+// number of clusters -d clusters makes, and how thick the sheet and
+// line are
+#define INITCLUSTERCOUNT 8
+#define INITTHICKNESS 1.0
+
+// key counterRandom() draws the starting positions from
+#define INITKEY 0x5eedUL
+
 // default number of iterations to run before exiting, only used
 // when graphics are turned off
 #define ITERATIONS 1000
@@ -45,6 +84,159 @@
 // default number of threads to run
 #define THREADS 4
 
+// number of timed iterations used to measure each thread count when
+// tuning, and the time after which a measurement is cut short
+#define CALIBRATE 5
+#define CALIBRATETIME 0.02
+
+// default number of iterations between re-tuning with -t auto
+#define RETUNE 250
+
+// default number of iterations between moving the split positions, off
+// by default since the splits follow timings and the order the flock
+// sums are added in follows the splits
+#define REBALANCE 0
+
+// default number of iterations between moving threads between the
+// groups of the hybrid engine, which has no even split to fall back on
+#define GROUPREBALANCE 10
+
+// engines that run an iteration, -e
+#define ENGINEDATA 0
+#define ENGINEHYBRID 1
+#define ENGINEASYNC 2
+
+// default number of iterations a block may read old positions from
+#define STALENESS 2
+
+// number of threads or tree nodes that arrive at each barrier node
+#define BARRIERFANIN 4
+
+// default number of times a thread checks the barrier before sleeping
+#define WAITSPINS 4000
+
+// split positions are multiples of this many boids, 16 boids fill whole
+// 64 byte cache lines in both boidArray (6 floats) and boidUpdate (3 floats)
+#define ALIGNBOIDS 16
+
+// how boid storage is backed, -H. auto tries 2 MB pages from the huge
+// page pool, then transparent huge pages, then normal pages
+#define PAGESNORMAL 0
+#define PAGESTHP 1
+#define PAGESHUGETLB 2
+#define PAGESAUTO 3
+
+// size of the huge pages used for boid storage
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+
+// how boid state is stored, -p. compact modes keep 2 bytes per value
+// and widen to float inside the kernels
+#define PRECISIONFLOAT 0
+#define PRECISIONHALF 1
+#define PRECISIONFIXED 2
+
+// steps per unit of the int16 mode, positions cover -512 to 512 in steps
+// of 1/64 and velocities -64 to 64 in steps of 1/512
+#define POSITIONSCALE 64.0
+#define VELOCITYSCALE 512.0
+
+// how rule 2 finds the boids to move away from, -s. exact checks every
+// boid, knn only the nearest few within 5.0 found through a grid
+#define SEPARATIONEXACT 0
+#define SEPARATIONKNN 1
+#define SEPARATIONSWEEP 2
+#define SEPARATIONSAMPLED 3
+
+// squared form of rule 2's distance(i,j) < 5.0 test, this is the largest
+// float below 25 so d*d < SEPARATION2 gives the same answer as
+// sqrtf(d*d) < 5.0 for every float without needing the square root
+#define SEPARATION2 0x1.8ffffep+4f
+
+// boids handled together by -s sweep, one per SIMD lane
+#define SWEEPLANES 8
+
+// -s sweep only moves to another axis when the flock is spread this much
+// further along it, so a flock spread about evenly on two axes is not
+// sorted from scratch every time they swap
+#define SWEEPSWITCH 1.1f
+
+// default fraction of the sweep window -s sampled looks at, and about
+// how many boids each iteration it also runs exactly to measure the error
+#define SAMPLERATE 0.1
+#define SAMPLECHECKS 64
+
+// default number of neighbours rule 2 moves away from with -s knn
+#define NEIGHBOURS 7
+
+// largest number of neighbours -k accepts
+#define MAXNEIGHBOURS 64
+
+// grid cells are sized so the average cell holds this fraction of the
+// neighbours, the 27 cells around a boid then usually hold enough
+#define CELLFILL 0.125
+
+// smallest extent of the flock along an axis when sizing the grid cells,
+// keeps cell coordinates in range when the flock is squeezed into a point
+#define MINCELL 0.05
+
+// most rings of cells a search goes out, cells are at least 5.0 over
+// this so a boid with nothing near it looks at no more than 17 x 17 x 17
+// cells before giving up
+#define SEARCHRINGS 8
+
+// real time mode, -R. a tick may take this fraction of its period
+// before rule 2 drops to fewer neighbours, and must take less than
+// TICKRECOVER of it before going back up. TICKHOLD ticks pass between
+// changes so the smoothed cost can settle, TICKSMOOTH is the weight of
+// the newest tick in it
+#define TICKBUDGET 0.8
+#define TICKRECOVER 0.5
+#define TICKHOLD 10
+#define TICKSMOOTH 0.25
+
+// most fidelity levels, the -s mode then knn with half the neighbours
+// at each level down to 1
+#define FIDELITYMAX 8
+
+// phases of an iteration timed by -P
+#define PHASESUMS 0
+#define PHASERULE1 1
+#define PHASERULE2 2
+#define PHASERULE3 3
+#define PHASEMOVE 4
+#define PHASEWAIT 5
+#define PHASEUPDATE 6
+#define PHASES 7
+
+// bytes and flops rule 2 spends on each boid it looks at, the other
+// phases' counts per boid are in phaseBytes[] and phaseFlops[]
+#define RULE2BYTES 12
+#define RULE2FLOPS 9
+
+// -P calibration, doubles in each of the three bandwidth arrays (32 MB
+// each, well past the caches), rounds of the flop kernel and the best
+// of how many runs is kept
+#define CALIBRATESIZE (4 << 20)
+// bandwidth is measured in each cache level and in memory, the cache
+// sizes come from sysconf() or these when it does not know them
+#define CALIBRATELEVELS 4
+#define LEVEL1SIZE (32 << 10)
+#define LEVEL2SIZE (1 << 20)
+#define LEVEL3SIZE (32 << 20)
+#define CALIBRATEROUNDS (1 << 16)
+#define CALIBRATEREPEATS 5
+// floats updated together by the flop kernel, enough independent
+// chains to keep the vector units busy
+#define CALIBRATELANES 64
+
+// default iterations between lines of the metrics stream, -m
+#define METRICSEVERY 10
+
+// headless frames, -o. default iterations between frames and width and
+// height of each frame in pixels
+#define FRAMEEVERY 10
+#define FRAMESIZE 512
+
 // boid location (x,y,z) and velocity (vx,vy,vz) in boidArray[][]
 #define BX 0
 #define BY 1
@@ -60,6 +252,19 @@
 #ifndef NOGRAPHICS
 // maximum screen dimensions
 int max_y = 0, max_x = 0;
+// occupancy of every screen cell in the frame being drawn and in the
+// frame on the terminal, 1 where at least one boid is shown
+char *frameCells;
+char *shownCells;
+// screen size the cell buffers were allocated for
+int frameRows = 0, frameCols = 0;
+// -v, and for the density view the boids each thread counted in each
+// cell and the number of counts allocated
+int viewMode;
+int *cellCounts;
+long countSize = 0;
+// scale from boid position to screen cell
+float cellMultx, cellMulty;
 #endif
 
 // user defined number of boids to create in the population
@@ -68,6 +273,49 @@ int popsize;
 float **boidArray;
 // change in velocity is stored for each boid (x,y,z)
 float **boidUpdate;
+// cache line aligned memory the rows of boidArray and boidUpdate point into
+float *boidStorage;
+float *updateStorage;
+// boid state in a compact mode, 6 values per boid like boidStorage. in
+// the timing build boidArray keeps the starting positions and is run
+// afterwards in float as the reference the drift is measured against
+int precision;
+#ifdef __FLT16_MAX__
+_Float16 *halfStorage;
+#endif
+short *fixedStorage;
+// positions of the compact state widened to float once per iteration,
+// rule 2 reads every other boid so it runs on these instead
+float *compactPositions;
+// values that did not fit in the int16 range and were clamped
+atomic_long fixedClamps;
+
+#ifdef NOGRAPHICS
+// headless frames, written as prefix00000.ppm every frameEvery iterations
+char *framePrefix;
+int frameEvery;
+int frameSize;
+int frameNumber;
+// light each thread splatted into every pixel (r,g,b), one frame each
+float *frameLight;
+// finished frames, one being filled while the writer saves the other
+unsigned char *framePixels[2];
+int frameFill;
+// frame waiting for the writer, -1 when it is idle, and when to stop
+int frameQueued;
+int frameStop;
+pthread_t frameWriter;
+pthread_mutex_t frameMutex;
+pthread_cond_t frameCond;
+// time spent drawing frames and waiting for the writer to take one
+double frameTime;
+double frameWait;
+#endif
+
+// the kind of pages asked for with -H, and the kind each array got
+int pageMode;
+int boidPages;
+int updatePages;
 
 // the number of tasks
 int threadsize;
@@ -75,62 +323,473 @@ int threadsize;
 double tasksize;
 // the threads to be used
 pthread_t* threadArray;
-// array of splits
+// array of splits, [first boid, end boid, thread index]
 int** splitArray;
 
+// rule 1 and rule 3 sums of one thread, padded to its own cache line
+struct partialSum {
+   float sum[6];
+   // sum of the squared positions and of the speeds, only on the
+   // iterations the metrics stream writes a line
+   double square;
+   double speed;
+   char pad[64 - 6 * sizeof(float) - 2 * sizeof(double)];
+};
+struct partialSum *partialSums;
+// 1 when partialSums holds the sums of the boids as the last
+// updateBoids() left them, so rule 1 and rule 3 can use them directly
+int sumsReady;
+
+// rule 2 mode and, for -s knn, the number of neighbours
+int separationMode;
+int neighbours;
+
+// grid for -s knn. boids are sorted by the hash of their cell, the boids
+// of bucket b are sortedBoids[bucketStart[b]] to sortedBoids[bucketStart[b+1]-1]
+int bucketsize;
+atomic_int *bucketFill;
+int *bucketStart;
+int *sortedBoids;
+// cell and bucket of every boid
+int (*cellCoord)[3];
+int *boidBucket;
+// corner of the grid and the size of each cell
+float gridOrigin[3];
+float cellSize;
+
+// real time mode, ticks per second or 0 to run as fast as possible.
+// fidelity 0 is the -s mode, each level after it uses knn with half the
+// neighbours of the level before
+double tickRate;
+int fidelity;
+int fidelityLevels;
+int baseSeparation;
+int baseNeighbours;
+// smoothed cost of a tick in seconds and ticks left before the level
+// may change again
+double tickCost;
+int fidelityHold;
+// ticks that must stay under TICKRECOVER before going back up a level,
+// doubled each time going up went straight over budget
+int recoverWait;
+int underBudget;
+int movedUp;
+// when the next tick is due, and what happened to the deadlines
+double nextDeadline;
+long ticksRun;
+long deadlinesMissed;
+double worstLate;
+long fidelityTicks[FIDELITYMAX];
+
+// -s sweep keeps boidArray sorted along sweepAxis, the axis the flock
+// is spread furthest along, and copies the positions into one array per
+// axis so rule 2 can scan them with vector loads
+int sweepAxis;
+float *sweepPosition[3];
+
+// each thread's share of building and searching the grid, padded to its
+// own cache line
+struct gridPart {
+   // boids looked at and neighbours used by rule 2
+   long scanned;
+   long used;
+   // bounding box of the thread's boids, low x,y,z then high x,y,z
+   float bounds[6];
+   // boids in the thread's range of buckets
+   int count;
+   char pad[64 - 2 * sizeof(long) - 6 * sizeof(float) - sizeof(int)];
+};
+struct gridPart *gridParts;
+
+// -M writes a line of flock metrics to metricsFile every metricsEvery
+// iterations. nothing is worked out just for them, updateBoids() adds
+// the squared positions and speeds to its sums and rule 2 counts the
+// boids it moves away from and the nearest of them, but only on the
+// iterations with metricsTick set. each thread's share of rule 2's
+// counts is padded to its own cache line
+char *metricsName;
+FILE *metricsFile;
+int metricsEvery;
+int metricsTick;
+struct metricPart {
+   // sum of the distance to the nearest boid within 5.0, over the
+   // touched boids that have one, and the number of boids rule 2 used
+   double nearestSum;
+   double contacts;
+   long touched;
+   char pad[64 - 2 * sizeof(double) - sizeof(long)];
+};
+struct metricPart *metricParts;
+
+// -P times each phase of an iteration on every thread, padded to its
+// own cache line, and reports the rates against the peak bandwidth and
+// flop rate measured at startup
+int profile;
+struct phaseTime {
+   double seconds[PHASES];
+   char pad[64 - PHASES * sizeof(double)];
+};
+struct phaseTime *phaseTimes;
+char *phaseNames[PHASES] = { "sums", "rule 1", "rule 2", "rule 3", "moveFlock", "barriers", "update" };
+// bytes read and written and flops per boid, rule 2 is counted per
+// boid looked at instead
+int phaseBytes[PHASES] = { 24, 24, 0, 36, 36, 0, 60 };
+// bytes per boid of the arrays each phase goes through, the working
+// set that picks the level a phase is compared with. rule 2 goes
+// through every boid's row on every thread, the others through a split
+int phaseFootprint[PHASES] = { 24, 36, 24, 36, 36, 0, 36 };
+int phaseFlops[PHASES] = { 6, 6, 0, 9, 9, 0, 12 };
+// iterations timed, iterations that worked out the sums and boids rule
+// 2 looked at
+long profileTicks;
+long sumsTicks;
+double rule2Pairs;
+long lastScanned;
+// time the main thread spent sorting or binning boids for rule 2
+double gridSeconds;
+// bandwidth of each level, and how many bytes a thread has in each
+// cache level, 0 for memory
+double peakBandwidth[CALIBRATELEVELS];
+long levelSize[CALIBRATELEVELS];
+char *levelNames[CALIBRATELEVELS] = { "L1", "L2", "L3", "memory" };
+double peakFlops;
+double *calibrateArrays[3];
+// doubles each thread's triad goes through, and how many times
+long triadLength;
+long triadRounds;
+// one row of chains per thread, each row is a whole number of cache lines
+float (*calibrateSink)[CALIBRATELANES];
+
+// shape of the starting flock and how many other boids are within 5.0
+// of a boid on average, 0 for the shape's own size. initSize is the
+// side of the cube, sheet or line or the spread of a cluster
+int initShape;
+char *initNames[] = { "uniform", "cluster", "clusters", "sheet", "line" };
+double initDensity;
+double initSize;
+
+// -s sampled looks at sampleRate of each boid's sweep window. each
+// thread adds up the error of the boids it also ran exactly, padded to
+// its own cache line
+double sampleRate;
+struct samplePart {
+   double errorSum;
+   double exactSum;
+   long checked;
+   char pad[64 - 2 * sizeof(double) - sizeof(long)];
+};
+struct samplePart *sampleParts;
+
+// node of the barrier tree, padded so nodes do not share cache lines
+struct barrierNode {
+   atomic_int arrived;
+   int children;
+   int parent;
+   char pad[64 - 3 * sizeof(int)];
+};
+
+// tree barrier, see waitBarrier()
+struct barrier {
+   struct barrierNode *nodes;
+   int nodesize;
+   int count;
+   // flipped by the last thread each phase, threads sleep on it
+   atomic_int sense;
+   // number of threads sleeping on sense
+   atomic_int sleepers;
+   // sense each thread is waiting for
+   int *localSense;
+};
+
+// barrier between the phases of an iteration
+struct barrier phaseBarrier;
+// times a waiting thread checks the barrier before sleeping, -1 never sleeps
+int waitSpins;
+// function the pool is running, NULL stops the pool
+void (*poolJob)(int);
+
+// engine running the iterations, and whether tuning picks it (-e auto)
+int engine;
+int autoEngine;
+
+// hybrid engine, the first groupsize threads do the sums, rule 1, rule 3
+// and moveFlock while the other threads split rule 2 between them
+int groupsize;
+// barrier between the sums and the rules of the first groupsize threads
+struct barrier groupBarrier;
+// rule 2 result in the hybrid engine, kept apart from boidUpdate because
+// rule 1 writes boidUpdate at the same time
+float **separationUpdate;
+float *separationStorage;
+
+// bounded staleness engine, each thread's split is a block that runs its
+// own iterations and reads the other blocks from snapshots at most
+// staleness iterations old
+int staleness;
+// number of snapshots kept, 2 * staleness + 2 so a snapshot is never
+// overwritten while it can still be read
+int ringsize;
+// positions (x,y,z) of every boid in each snapshot
+float *asyncPositions;
+// rule 1 and rule 3 sums of each block in each snapshot
+float (*asyncSums)[6];
+// iterations to run in the current asyncJob()
+int asyncFirst;
+int asyncIterations;
+
+// newest snapshot each block has finished writing, the other blocks
+// poll it so it is alone on its cache line
+struct asyncBlock {
+   _Alignas(64) atomic_int published;
+};
+_Static_assert(sizeof(struct asyncBlock) == 64, "asyncBlock must fill one cache line");
+struct asyncBlock *asyncBlocks;
+
+// what each block measures, only written by its own thread and kept
+// off the lines the other blocks poll
+struct asyncStat {
+   // staleness of the snapshots this block read from other blocks
+   _Alignas(64) long stalenessSum;
+   long stalenessReads;
+   int stalenessMax;
+   // time spent waiting for blocks more than staleness behind
+   double waitTime;
+};
+_Static_assert(sizeof(struct asyncStat) == 64, "asyncStat must fill one cache line");
+struct asyncStat *asyncStats;
+
+// iterations between moving the splits, 0 keeps them fixed
+int rebalance;
+// iterations since the splits were last moved
+int rebalanceCount;
+// the same for the hybrid engine's groups
+int groupRebalance;
+// time each thread spent in rule 2 since the splits were last moved
+double *splitCost;
+
+// pick the number of threads at run time (-t auto)
+int autoThreads;
+// iterations between re-tuning, 0 to only tune at startup
+int retune;
+// largest number of threads the process is allowed to use
+int maxThreads;
+// total time spent tuning
+double tuneTime;
+
+// moveFlock() state, advanced once per iteration by moveBoids()
+int flockCount;
+int flockSign;
+
 // timing
 struct timespec startTime;
 struct timespec endTime;
 double elapsedTime;
 
+// functions called before they are defined
+void rebalanceThreads();
+void rebalanceGroups();
+int alignSplit(double position);
+unsigned long counterRandom(unsigned long key, unsigned long counter);
+void runPool(void (*job)(int));
+void *allocatePages(size_t size, int mode, int *got);
+void knnRule2(int id, int min, int max, float **update, int add);
+void sweepRule2(int id, int min, int max, float **update, int add);
+void sampledRule2(int id, int min, int max, float **update, int add);
+void writeMetrics();
+void countPairs();
+#ifndef NOGRAPHICS
+void densityCells();
+#endif
+
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 
-// intial boids
-void initBoids() {
-   
-   // variables
-   int i;
+// uniform number in [0,1) from draw k of boid i
+double initUniform(int i, int k) {
+   return((counterRandom(INITKEY, (unsigned long)i * 8 + k) >> 11) * 0x1p-53);
+}
 
-   // calculate initial random locations for each boid, scaled based on the screen size
-   for(i=0; i<popsize; i++) {
-      boidArray[i][BX] = (float) (random() % SCREENSIZE);
-      boidArray[i][BY] = (float) (random() % SCREENSIZE);
-      boidArray[i][BZ] = (float) (random() % SCREENSIZE);
+// normal number from draws k and k+1 of boid i, Box-Muller
+double initNormal(int i, int k) {
+   return(sqrt(-2.0 * log(1.0 - initUniform(i, k))) * cos(2.0 * M_PI * initUniform(i, k + 1)));
+}
+
+// place the boids of this thread's split. every boid's draws only depend
+// on its index, so the flock is the same for any number of threads, and
+// each thread first touches the pages of the boids it will update
+void initJob(int id) {
+
+   // variables
+   int i, k, c;
+   double centre[3];
+   double half = SCREENSIZE / 2.0;
+
+
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++) {
+      switch(initShape) {
+      // whole numbers like the default start, which the compact modes
+      // store exactly
+      case INITUNIFORM:
+         for(k=0; k<3; k++)
+            boidArray[i][BX+k] = (float)floor(half + (initUniform(i, k) - 0.5) * initSize);
+         break;
+
+      // the clusters are in order of boid, so each thread's split is
+      // mostly inside one or two of them
+      case INITCLUSTER:
+      case INITCLUSTERS:
+         c = initShape == INITCLUSTER ? 0 : (int)((long)i * INITCLUSTERCOUNT / popsize);
+         for(k=0; k<3; k++) {
+            if (initShape == INITCLUSTER)
+               centre[k] = half;
+            else
+               centre[k] = (counterRandom(INITKEY, ~(unsigned long)(c * 3 + k)) >> 11) * 0x1p-53 * SCREENSIZE;
+            boidArray[i][BX+k] = (float)(centre[k] + initNormal(i, 2 * k) * initSize);
+         }
+         break;
+
+      case INITSHEET:
+         boidArray[i][BX] = (float)(half + (initUniform(i, 0) - 0.5) * initSize);
+         boidArray[i][BY] = (float)(half + (initUniform(i, 1) - 0.5) * initSize);
+         boidArray[i][BZ] = (float)(half + (initUniform(i, 2) - 0.5) * INITTHICKNESS);
+         break;
+
+      case INITLINE:
+         boidArray[i][BX] = (float)(half + (initUniform(i, 0) - 0.5) * initSize);
+         boidArray[i][BY] = (float)(half + (initUniform(i, 1) - 0.5) * INITTHICKNESS);
+         boidArray[i][BZ] = (float)(half + (initUniform(i, 2) - 0.5) * INITTHICKNESS);
+         break;
+      }
       boidArray[i][VX] = 0.0;
       boidArray[i][VY] = 0.0;
       boidArray[i][VZ] = 0.0;
    }
 }
 
+// intial boids
+void initBoids() {
+
+   // variables
+   double ball = 4.0 / 3.0 * M_PI * 125.0;
+   double others = popsize > 1 ? popsize - 1 : 1;
+
+
+   // size each shape so a boid has initDensity other boids within 5.0
+   // on average. a cluster's normal spread has on average the density
+   // of a cube of side sqrt(4 pi) spreads, a sheet's boids within 5.0
+   // are in a disc and a line's in a segment 10.0 long
+   if (initDensity > 0.0) {
+      switch(initShape) {
+      case INITUNIFORM:
+         initSize = cbrt(others * ball / initDensity);
+         break;
+      case INITCLUSTER:
+         initSize = cbrt(others * ball / initDensity) / sqrt(4.0 * M_PI);
+         break;
+      case INITCLUSTERS:
+         initSize = cbrt(others / INITCLUSTERCOUNT * ball / initDensity) / sqrt(4.0 * M_PI);
+         break;
+      case INITSHEET:
+         initSize = sqrt(others * 25.0 * M_PI / initDensity);
+         break;
+      case INITLINE:
+         initSize = others * 10.0 / initDensity;
+         break;
+      }
+   } else {
+      switch(initShape) {
+      case INITCLUSTER:
+         initSize = SCREENSIZE / 10.0;
+         break;
+      case INITCLUSTERS:
+         initSize = SCREENSIZE / 20.0;
+         break;
+      default:
+         initSize = SCREENSIZE;
+      }
+   }
+
+   runPool(initJob);
+
+   // the default start is boids.c's random() % SCREENSIZE, so a run
+   // starts from the same flock as boids, test and microbench. random()
+   // is one sequence that cannot be split between threads, so it is
+   // drawn here after initJob() has touched the pages
+   if (initShape == INITUNIFORM && initDensity == 0.0)
+      for(int i=0; i<popsize; i++) {
+         boidArray[i][BX] = (float) (random() % SCREENSIZE);
+         boidArray[i][BY] = (float) (random() % SCREENSIZE);
+         boidArray[i][BZ] = (float) (random() % SCREENSIZE);
+      }
+}
+
 // draw boids
 #ifndef NOGRAPHICS
 int drawBoids() {
    
    // variables
    int c, i;
+   int row, col;
    float multx, multy;
+   char *swap;
 
    // update screen maximum size
    getmaxyx(stdscr, max_y, max_x);
 
+   // a new screen size starts from an empty terminal and empty buffers
+   if (max_y != frameRows || max_x != frameCols) {
+      free(frameCells);
+      free(shownCells);
+      frameCells = calloc((size_t)max_y * max_x, 1);
+      shownCells = calloc((size_t)max_y * max_x, 1);
+      frameRows = max_y;
+      frameCols = max_x;
+      clear();
+   }
+
    // used to scale position of boids based on screen size
    multx = (float)max_x / SCREENSIZE;
    multy = (float)max_y / SCREENSIZE;
 
-   clear();
+   // mark the cells holding a boid, boids off the screen are not shown.
+   // the density view counts the boids of each cell on every thread
+   if (viewMode == VIEWDENSITY) {
+      cellMultx = multx;
+      cellMulty = multy;
+      densityCells();
+   } else {
+      memset(frameCells, 0, (size_t)frameRows * frameCols);
+      for (i=0; i<popsize; i++) {
+         row = (int)(boidArray[i][BX]*multy);
+         col = (int)(boidArray[i][BY]*multx);
+         if (row >= 0 && row < frameRows && col >= 0 && col < frameCols)
+            frameCells[row * frameCols + col] = 1;
+      }
+   }
 
-   // display boids
-   for (i=0; i<popsize; i++) {
-      mvprintw((int)(boidArray[i][BX]*multy), (int)(boidArray[i][BY]*multx), "o");
+   // only send the cells that changed since the last frame, clear()
+   // would repaint the whole terminal
+   for (i=0; i<frameRows * frameCols; i++) {
+      if (frameCells[i] == shownCells[i])
+         continue;
+      if (viewMode == VIEWDENSITY)
+         mvaddch(i / frameCols, i % frameCols,
+            DENSITYGLYPHS[(int)frameCells[i]] | COLOR_PAIR(frameCells[i]));
+      else
+         mvaddch(i / frameCols, i % frameCols, frameCells[i] ? 'o' : ' ');
    }
+   swap = shownCells;
+   shownCells = frameCells;
+   frameCells = swap;
 
    refresh();
 
-   usleep(DELAY);
+   // the real time mode waits for its own deadlines
+   if (tickRate == 0.0)
+      usleep(DELAY);
 
    // read keyboard and exit if 'q' pressed
    c = getch();
@@ -139,37 +798,65 @@ int drawBoids() {
 }
 #endif
 
-// rule 1
-void *rule1(void* data) {
-   
+// rule 1 and rule 3 sums
+void sumBoids(int id, int min, int max) {
+
    // variables
    int i;
    float cx, cy, cz;
-
-   // thread variables
-   int min;
-   int max;
-   int* positions;
+   float vx, vy, vz;
 
 
    cx = 0.0; cy = 0.0; cz = 0.0;
+   vx = 0.0; vy = 0.0; vz = 0.0;
 
-   // assign
-   positions = (int*)data;
-   min = positions[0];
-   max = positions[1];
-   
-
-   // calculate centre of mass
-   // calculated once and used for all updates in rule 1
+   // sum position and velocity of this thread's boids, the sums of all
+   // threads are added together to get the centre of mass and average
+   // velocity of the whole flock
    for(i=min; i<max; i++) {
       cx += boidArray[i][BX];
       cy += boidArray[i][BY];
       cz += boidArray[i][BZ];
+      vx += boidArray[i][VX];
+      vy += boidArray[i][VY];
+      vz += boidArray[i][VZ];
    }
-   cx /= popsize;
-   cy /= popsize;
-   cz /= popsize;
+
+   partialSums[id].sum[BX] = cx;
+   partialSums[id].sum[BY] = cy;
+   partialSums[id].sum[BZ] = cz;
+   partialSums[id].sum[VX] = vx;
+   partialSums[id].sum[VY] = vy;
+   partialSums[id].sum[VZ] = vz;
+}
+
+// add the sums of the first count threads, every thread does this for
+// itself after the barrier that follows sumBoids()
+void flockSums(float *sums, int count) {
+
+   // variables
+   int i, k;
+
+   for(k=0; k<6; k++)
+      sums[k] = 0.0;
+
+   for(i=0; i<count; i++)
+      for(k=0; k<6; k++)
+         sums[k] += partialSums[i].sum[k];
+}
+
+// rule 1
+void rule1(int min, int max, float *sums) {
+   
+   // variables
+   int i;
+   float cx, cy, cz;
+
+
+   // centre of mass of the whole flock
+   cx = sums[BX] / popsize;
+   cy = sums[BY] / popsize;
+   cz = sums[BZ] / popsize;
 
    // update velocity, move towards centre of mass
    // initial use of boidUpdate[][] so overwrite old values
@@ -178,8 +865,6 @@ void *rule1(void* data) {
       boidUpdate[i][BY] = (cy - boidArray[i][BY])/popsize;
       boidUpdate[i][BZ] = (cz - boidArray[i][BZ])/popsize;
    }
-
-   return NULL;
 }
 
 // distance
@@ -192,75 +877,102 @@ float distance(int i, int j) {
       powf(boidArray[i][BZ] - boidArray[j][BZ],2.0) ));
 }
 
-// rule 2
-void *rule2(void* data) {
+// add a thread's rule 2 counts to the metrics stream
+void addMetrics(int id, long touched, double contacts, double nearestSum) {
+   metricParts[id].touched += touched;
+   metricParts[id].contacts += contacts;
+   metricParts[id].nearestSum += nearestSum;
+}
+
+// rule 2 for boids min to max, id is the thread for timing
+void rule2(int id, int min, int max, float **update, int add) {
    
    // variables
    int i, j;
    float cx, cy, cz;
-   
-   // thread variables
-   int min;
-   int max;
-   int* positions;
+   float d, near;
+   int touching;
+   long touched;
+   long contacts;
+   double nearestSum;
 
+   // timing
+   struct timespec ruleStart;
+   struct timespec ruleEnd;
 
-   // assign
-   positions = (int*)data;
-   min = positions[0];
-   max = positions[1];
+
+   // cpu time used by this thread, so waiting for a core is not counted
+   // as work when the splits are rebalanced
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ruleStart);
 
 
+   touched = 0;
+   contacts = 0;
+   nearestSum = 0.0;
+
    // keep boids from overlapping
+   if (separationMode == SEPARATIONKNN)
+      knnRule2(id, min, max, update, add);
+   else if (separationMode == SEPARATIONSWEEP)
+      sweepRule2(id, min, max, update, add);
+   else if (separationMode == SEPARATIONSAMPLED)
+      sampledRule2(id, min, max, update, add);
+   else
    for(i=min; i<max; i++) {
       cx = 0.0; cy = 0.0; cz = 0.0;
+      near = 5.0;
+      touching = 0;
       for(j=0; j<popsize; j++) {
          if (i != j) {		// calculate when not the same boid
-            if (distance(i,j) < 5.0) {
+            d = distance(i,j);
+            if (d < 5.0) {
                cx = cx - (boidArray[j][BX] - boidArray[i][BX]);
                cy = cy - (boidArray[j][BY] - boidArray[i][BY]);
                cz = cz - (boidArray[j][BZ] - boidArray[i][BZ]);
+               // counted for the metrics stream, rare enough to be free
+               touching++;
+               near = fminf(near, d);
             }
          }
       }
-      boidUpdate[i][BX] += cx;
-      boidUpdate[i][BY] += cy;
-      boidUpdate[i][BZ] += cz;
+      if (touching > 0) {
+         touched++;
+         contacts += touching;
+         nearestSum += near;
+      }
+      // added to rule 1's update, or kept apart when the rules run at
+      // the same time in the hybrid engine
+      if (add) {
+         update[i][BX] += cx;
+         update[i][BY] += cy;
+         update[i][BZ] += cz;
+      } else {
+         update[i][BX] = cx;
+         update[i][BY] = cy;
+         update[i][BZ] = cz;
+      }
    }
 
-   return NULL;
+   if (metricsTick && separationMode == SEPARATIONEXACT)
+      addMetrics(id, touched, contacts, nearestSum);
+
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ruleEnd);
+   splitCost[id] += (ruleEnd.tv_sec - ruleStart.tv_sec);
+   splitCost[id] += (ruleEnd.tv_nsec - ruleStart.tv_nsec) / 1000000000.0;
 }
 
 // rule 3
-void *rule3(void* data) {
+void rule3(int min, int max, float *sums) {
    
    // variables
    int i;
    float cx, cy, cz;
 
-   int min;
-   int max;
-   int* positions;
-
-
-   // assign
-   positions = (int*)data;
-   min = positions[0];
-   max = positions[1];
-
-
-   cx = 0.0; cy = 0.0; cz = 0.0;
 
-   // calculate average velocity
-   // calculate once and use for all updates in rule 3
-   for(i=min; i<max; i++) {
-      cx += boidArray[i][VX];
-      cy += boidArray[i][VY];
-      cz += boidArray[i][VZ];
-   }
-   cx /= popsize;
-   cy /= popsize;
-   cz /= popsize;
+   // average velocity of the whole flock
+   cx = sums[VX] / popsize;
+   cy = sums[VY] / popsize;
+   cz = sums[VZ] / popsize;
 
    // update velocity, move towards centre of mass
    for(i=min; i<max; i++) {
@@ -268,37 +980,19 @@ void *rule3(void* data) {
       boidUpdate[i][BY] += (cy - boidArray[i][VY])/8.0;
       boidUpdate[i][BZ] += (cz - boidArray[i][VZ])/8.0;
    }
-
-   return NULL;
 }
 
 
 // move the flock towards a point
-void *moveFlock(void* data) {
+void moveFlock(int min, int max, int sign) {
    
    // variables
    int i;
-   static int count = 0;
-   static int sign = 1;
    float px, py, pz;
 
-   // thread variables
-   int min;
-   int max;
-   int* positions;
-
-
-   // assign
-   positions = (int*)data;
-   min = positions[0];
-   max = positions[1];
-
 
-   // pull flock towards two points as the program runs
-   // every 200 iterations change point that flock is pulled towards
-   if (count % 200 == 0) {
-      sign = sign * -1;
-   }
+   // pull flock towards two points as the program runs, moveBoids()
+   // changes flockSign every 200 iterations
    if (sign == 1) {
    // move flock towards position (40,40,40)
       px = 40.0;
@@ -317,28 +1011,23 @@ void *moveFlock(void* data) {
       boidUpdate[i][BY] += (py - boidArray[i][BY])/200.0;
       boidUpdate[i][BZ] += (pz - boidArray[i][BZ])/200.0;
    }
-   count++;
-
-   return NULL;
 }
 
-void *updateBoids(void* data) {
+// update the boids, and sum the new positions and velocities as
+// sumBoids() would so the next iteration does not need to read the
+// boids again before rule 1 and rule 3
+void updateBoids(int id, int min, int max) {
 
    // variables 
    int i;
-   
-   // thread variables
-   int min;
-   int max;
-   int* positions;
+   float cx, cy, cz;
+   float vx, vy, vz;
+   double square, speed;
 
-   
-   // assign
-   positions = (int*)data;
-   min = positions[0];
-   max = positions[1];
 
-   //printf("STARTING   %d %d\n", min, max);
+   cx = 0.0; cy = 0.0; cz = 0.0;
+   vx = 0.0; vy = 0.0; vz = 0.0;
+   square = 0.0; speed = 0.0;
 
    for (i = min; i < max; i++) {
       
@@ -351,11 +1040,33 @@ void *updateBoids(void* data) {
       boidArray[i][BX] += boidArray[i][VX];
       boidArray[i][BY] += boidArray[i][VY];
       boidArray[i][BZ] += boidArray[i][VZ];
-   }
 
-   //printf("COMPLETING %d %d\n", min, max);
+      cx += boidArray[i][BX];
+      cy += boidArray[i][BY];
+      cz += boidArray[i][BZ];
+      vx += boidArray[i][VX];
+      vy += boidArray[i][VY];
+      vz += boidArray[i][VZ];
+
+      // the same loop feeds the metrics stream's spread and speed
+      if (metricsTick) {
+         square += (double)boidArray[i][BX] * boidArray[i][BX]
+            + (double)boidArray[i][BY] * boidArray[i][BY]
+            + (double)boidArray[i][BZ] * boidArray[i][BZ];
+         speed += sqrtf(boidArray[i][VX] * boidArray[i][VX]
+            + boidArray[i][VY] * boidArray[i][VY]
+            + boidArray[i][VZ] * boidArray[i][VZ]);
+      }
+   }
 
-   return NULL;
+   partialSums[id].square = square;
+   partialSums[id].speed = speed;
+   partialSums[id].sum[BX] = cx;
+   partialSums[id].sum[BY] = cy;
+   partialSums[id].sum[BZ] = cz;
+   partialSums[id].sum[VX] = vx;
+   partialSums[id].sum[VY] = vy;
+   partialSums[id].sum[VZ] = vz;
 }
 
 
@@ -364,191 +1075,3283 @@ void *updateBoids(void* data) {
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 
-// move boids
-void moveBoids() {
-
-   // variables
-   int i;
+// the threads are created once and wait at a barrier between phases
+// instead of being created and joined for every rule. the barrier is a
+// combining tree, threads arrive in groups of BARRIERFANIN so no single
+// counter is hit by every thread, and the last thread to reach the root
+// flips one sense word that releases everyone. waiting threads spin for
+// waitSpins rounds and then sleep on the sense word with a futex.
 
 
-   // all functions follow thesame pattern where each rule is multi threaded
-   // but each rule has its own thread barrier.
-   //
-   // this is due to the nature of the some of the rule, rule 2 could potentially
-   // interfere with the code the rule 1 if they were to run at the same time.
-   // 
-   // a thread barrier for each rule ensures that we dont run into any
-   // overlap while keeping the system multi threaded.
+// give the other hyperthread the core while spinning
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#elif defined(__aarch64__)
+   __asm__ __volatile__("yield");
+#endif
+}
 
+// sleep while *word still holds value
+void futexWait(atomic_int *word, int value) {
+#ifdef __linux__
+   syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+   if (atomic_load(word) == value)
+      sched_yield();
+#endif
+}
 
-   // rule 1
-   for(i = 0; i < threadsize; i++)
-      pthread_create(&threadArray[i], NULL, rule1, splitArray[i]);
+// wake every thread sleeping on word
+void futexWake(atomic_int *word) {
+#ifdef __linux__
+   syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
 
-   for(i = 0; i < threadsize; i++)
-      pthread_join(threadArray[i], NULL);
+// build the tree for count threads
+void initBarrier(struct barrier *b, int count) {
 
+   // variables
+   int i;
+   int level;
+   int levelsize;
+   int first;
+
+
+   // the nodes of each level follow the nodes of the level below, the
+   // leaves come first and have threads as children
+   b->nodes = malloc(sizeof(struct barrierNode) * (count + 1));
+   b->nodesize = 0;
+   first = 0;
+   levelsize = count;
+   for(level = 0; level == 0 || levelsize > 1; level++) {
+      for(i = 0; i < (levelsize + BARRIERFANIN - 1) / BARRIERFANIN; i++) {
+         atomic_init(&b->nodes[b->nodesize + i].arrived, 0);
+         b->nodes[b->nodesize + i].children = levelsize - i * BARRIERFANIN;
+         if (b->nodes[b->nodesize + i].children > BARRIERFANIN)
+            b->nodes[b->nodesize + i].children = BARRIERFANIN;
+         b->nodes[b->nodesize + i].parent = -1;
+      }
 
-   // rule 2
-   for(i = 0; i < threadsize; i++)
-      pthread_create(&threadArray[i], NULL, rule2, splitArray[i]);
-   
-   for(i = 0; i < threadsize; i++)
-      pthread_join(threadArray[i], NULL);
+      // point the nodes of the level below at this level
+      if (level > 0)
+         for(i = first; i < b->nodesize; i++)
+            b->nodes[i].parent = b->nodesize + (i - first) / BARRIERFANIN;
 
+      first = b->nodesize;
+      b->nodesize += (levelsize + BARRIERFANIN - 1) / BARRIERFANIN;
+      levelsize = (levelsize + BARRIERFANIN - 1) / BARRIERFANIN;
+   }
 
-   // rule 3
-   for(i = 0; i < threadsize; i++)
-      pthread_create(&threadArray[i], NULL, rule3, splitArray[i]);
+   atomic_init(&b->sense, 0);
+   atomic_init(&b->sleepers, 0);
+   b->localSense = calloc(count, sizeof(int));
+   b->count = count;
+}
 
-   for(i = 0; i < threadsize; i++)
-      pthread_join(threadArray[i], NULL);
-   
+// free the tree
+void freeBarrier(struct barrier *b) {
+   free(b->nodes);
+   free(b->localSense);
+}
 
-   // move flock
-   for(i = 0; i < threadsize; i++)
-      pthread_create(&threadArray[i], NULL, moveFlock, splitArray[i]);
+// wait until all b->count threads have called waitBarrier()
+void waitBarrier(struct barrier *b, int id) {
 
-   for(i = 0; i < threadsize; i++)
-      pthread_join(threadArray[i], NULL);
+   // variables
+   int node;
+   int sense;
+   int spins;
+
+
+   // the sense this phase finishes with
+   sense = !b->localSense[id];
+   b->localSense[id] = sense;
+
+   // climb the tree while this thread is the last to arrive at a node
+   node = id / BARRIERFANIN;
+   while(node >= 0) {
+      if (atomic_fetch_add(&b->nodes[node].arrived, 1) != b->nodes[node].children - 1)
+         break;
+      atomic_store_explicit(&b->nodes[node].arrived, 0, memory_order_relaxed);
+      node = b->nodes[node].parent;
+   }
 
+   // last thread at the root, release everybody
+   if (node < 0) {
+      atomic_store(&b->sense, sense);
+      if (atomic_load(&b->sleepers) > 0)
+         futexWake(&b->sense);
+      return;
+   }
 
-   // update boids
-   for(i = 0; i < threadsize; i++)
-      pthread_create(&threadArray[i], NULL, updateBoids, splitArray[i]);
+   // spin for a while, this is fastest when every thread has its own core
+   for(spins = 0; waitSpins < 0 || spins < waitSpins; spins++) {
+      if (atomic_load_explicit(&b->sense, memory_order_acquire) == sense)
+         return;
+      cpuRelax();
+   }
 
-   for(i = 0; i < threadsize; i++)
-      pthread_join(threadArray[i], NULL);
-      
+   // then sleep so a waiting thread does not take a core from a working one
+   atomic_fetch_add(&b->sleepers, 1);
+   while(atomic_load(&b->sense) != sense)
+      futexWait(&b->sense, !sense);
+   atomic_fetch_sub(&b->sleepers, 1);
 }
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-// allocate arrays
-void allocateArrays() {
-   
-   // variables
-   int i;
 
-   boidArray = malloc(sizeof(float *) * popsize);
-   for(i=0; i<popsize; i++)
-      boidArray[i] = malloc(sizeof(float) * 6);
+// with -P add the time since mark to phase of thread id and move mark on
+void phaseMark(int id, int phase, struct timespec *mark) {
 
-   boidUpdate = malloc(sizeof(float *) * popsize);
-   for(i=0; i<popsize; i++)
-      boidUpdate[i] = malloc(sizeof(float) * 3);
+   // variables
+   struct timespec now;
 
+
+   if (!profile)
+      return;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   phaseTimes[id].seconds[phase] += (now.tv_sec - mark->tv_sec)
+      + (now.tv_nsec - mark->tv_nsec) / 1000000000.0;
+   *mark = now;
 }
 
-// allocate threads
-void allocateThreads() {
+// one iteration of the simulation for thread id
+void tickJob(int id) {
 
-   // variabels
-   int sum;
-   int cur;
+   // variables
+   int min;
+   int max;
+   float sums[6];
+   struct timespec mark;
 
 
    // assign
-   threadArray = malloc(sizeof(pthread_t) * threadsize);
+   min = splitArray[id][0];
+   max = splitArray[id][1];
+   if (profile)
+      clock_gettime(CLOCK_MONOTONIC, &mark);
+
+   // rule 1 and rule 3 need the sums over the whole flock before any
+   // boid can be updated. the last updateBoids() already left them in
+   // partialSums unless the boids or splits have changed since
+   if (!sumsReady) {
+      sumBoids(id, min, max);
+      phaseMark(id, PHASESUMS, &mark);
+      waitBarrier(&phaseBarrier, id);
+      phaseMark(id, PHASEWAIT, &mark);
+   }
+   flockSums(sums, threadsize);
+
+   // each thread only writes boidUpdate for its own boids and every rule
+   // only reads boidArray so the rules do not need barriers between them
+   rule1(min, max, sums);
+   phaseMark(id, PHASERULE1, &mark);
+   rule2(id, min, max, boidUpdate, 1);
+   phaseMark(id, PHASERULE2, &mark);
+   rule3(min, max, sums);
+   phaseMark(id, PHASERULE3, &mark);
+   moveFlock(min, max, flockSign);
+   phaseMark(id, PHASEMOVE, &mark);
+
+   // rule 2 reads the positions of every boid, they can only be moved
+   // once all threads are finished with it
+   waitBarrier(&phaseBarrier, id);
+   phaseMark(id, PHASEWAIT, &mark);
+   updateBoids(id, min, max);
+   phaseMark(id, PHASEUPDATE, &mark);
+}
 
-   // malloc for the splits
-   splitArray = malloc(sizeof(int*) * (threadsize));
-   for(int i = 0; i < threadsize; i++)
-      splitArray[i] = malloc(sizeof(int) * 2);
-   
+// seconds between two clock readings
+double secondsBetween(struct timespec *start, struct timespec *end) {
+   return((end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
 
-   // calculate the number of splits based on 
-   tasksize = (double)popsize / (double)threadsize;
+// start of part index when the boids are split into count equal parts
+int groupSplit(int index, int count) {
 
-   // generate the split until the second last split was created
-   sum = 0;
-   cur = 0;
-   splitArray[0][0] = 0;
-   for(int i = 0; i < popsize && cur < threadsize - 1; i++){
+   if (index >= count)
+      return(popsize);
+   return(alignSplit((double)popsize * index / count));
+}
 
-      // increase the sum until its the same or larger than tasksize
-      sum++;
+// one iteration of the hybrid engine for thread id. the O(N) work of
+// rule 1, rule 3 and moveFlock runs on the first groupsize threads at
+// the same time as the O(N*N) rule 2 runs on the rest
+void hybridJob(int id) {
 
-      // catch a split position
-      if((double)sum >= tasksize){
+   // variables
+   int i;
+   int min;
+   int max;
+   float sums[6];
+   struct timespec groupStart;
+   struct timespec groupEnd;
+   struct timespec mark;
+
+
+   if (profile)
+      clock_gettime(CLOCK_MONOTONIC, &mark);
+
+   if (id < groupsize) {
+      min = groupSplit(id, groupsize);
+      max = groupSplit(id + 1, groupsize);
+
+      // the sums are usually left by every thread's updateBoids(),
+      // otherwise the group works them out first. the time spent waiting
+      // for the rest of the group is not work
+      if (!sumsReady) {
+         clock_gettime(CLOCK_THREAD_CPUTIME_ID, &groupStart);
+         sumBoids(id, min, max);
+         clock_gettime(CLOCK_THREAD_CPUTIME_ID, &groupEnd);
+         splitCost[id] += secondsBetween(&groupStart, &groupEnd);
+         phaseMark(id, PHASESUMS, &mark);
+
+         waitBarrier(&groupBarrier, id);
+         phaseMark(id, PHASEWAIT, &mark);
+      }
 
-         // store position and iterate
-         splitArray[cur++][1] = i;
-         splitArray[cur][0] = i;
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &groupStart);
+      flockSums(sums, sumsReady ? threadsize : groupsize);
+      rule1(min, max, sums);
+      phaseMark(id, PHASERULE1, &mark);
+      rule3(min, max, sums);
+      phaseMark(id, PHASERULE3, &mark);
+      moveFlock(min, max, flockSign);
+      phaseMark(id, PHASEMOVE, &mark);
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &groupEnd);
+      splitCost[id] += secondsBetween(&groupStart, &groupEnd);
 
-         // reset the sum
-         sum = 0;
-      }
+   } else {
+      min = groupSplit(id - groupsize, threadsize - groupsize);
+      max = groupSplit(id - groupsize + 1, threadsize - groupsize);
+      rule2(id, min, max, separationUpdate, 0);
+      phaseMark(id, PHASERULE2, &mark);
    }
 
-   // assign the last position to our array
-   splitArray[threadsize - 1][1] = popsize -1;
+   waitBarrier(&phaseBarrier, id);
+   phaseMark(id, PHASEWAIT, &mark);
+
+   // every thread moves its own split of the boids
+   min = splitArray[id][0];
+   max = splitArray[id][1];
+   for(i=min; i<max; i++) {
+      boidUpdate[i][BX] += separationUpdate[i][BX];
+      boidUpdate[i][BY] += separationUpdate[i][BY];
+      boidUpdate[i][BZ] += separationUpdate[i][BZ];
+   }
+   updateBoids(id, min, max);
+   phaseMark(id, PHASEUPDATE, &mark);
 }
 
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+// change the number of threads doing the O(N) work of the hybrid engine
+void setGroupsize(int size) {
 
+   if (size == groupsize)
+      return;
+
+   freeBarrier(&groupBarrier);
+   groupsize = size;
+   initBarrier(&groupBarrier, groupsize);
+}
+
+// split the threads between the two groups of the hybrid engine so the
+// measured time per thread is the same in both
+void rebalanceGroups() {
 
-// main function
-int main(int argc, char *argv[]) {
-   
    // variables
    int i;
-   int count;
-   int argPtr;
+   int best;
+   double costSums;
+   double costRule2;
+   double perThread;
+   double bestPerThread;
+
+
+   costSums = 0.0;
+   costRule2 = 0.0;
+   for(i = 0; i < threadsize; i++) {
+      if (i < groupsize)
+         costSums += splitCost[i];
+      else
+         costRule2 += splitCost[i];
+      splitCost[i] = 0.0;
+   }
+   rebalanceCount = 0;
+
+   if (costSums <= 0.0 || costRule2 <= 0.0)
+      return;
+
+   best = groupsize;
+   bestPerThread = 0.0;
+   for(i = 1; i < threadsize; i++) {
+      perThread = costSums / i > costRule2 / (threadsize - i) ? costSums / i : costRule2 / (threadsize - i);
+      if (i == 1 || perThread < bestPerThread) {
+         bestPerThread = perThread;
+         best = i;
+      }
+   }
 
+   setGroupsize(best);
+}
 
-   // assign intial values
-   // set the default population size
-   popsize = POPSIZE;
-   
-   // set number of iterations, only used for timing tests in boidspt
-   // not used in curses version
-   count = ITERATIONS;
+// worker threads run poolJob each time runPool() is called
+void *poolWorker(void *data) {
 
-   // set the number of threads to use
-   threadsize = THREADS;
+   // variables
+   int id;
 
+   id = (int)(long)data;
 
-   // read command line arguments for number of iterations and
-   // number of boids
-   if (argc > 1) {
-      argPtr = 1;
-      while(argPtr < argc) {
-         if (strcmp(argv[argPtr], "-i") == 0) {
-            sscanf(argv[argPtr+1], "%d", &count);
-            argPtr += 2;
-         } else if (strcmp(argv[argPtr], "-c") == 0) {
-            sscanf(argv[argPtr+1], "%d", &popsize);
-            argPtr += 2;
-         } else if (strcmp(argv[argPtr], "-t") == 0) {
-            sscanf(argv[argPtr+1], "%d", &threadsize);
-            argPtr += 2;
-         } else {
-            printf("USAGE: %s <-i iterations> <-c pop_size> <-t threads>\n", argv[0]);
-            printf("\n");
-            printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
-            printf("\n");
-            printf("   iterations -the number of times the population will be updated\n");
-            printf("\n");
-            printf("   pop_size -the number of boids to create\n");
-            printf("   the number of iterations only affects the non-curses program boidspt\n");
-            printf("   the curses program exits when q is pressed\n");
-            printf("\n");
-            printf("   threads -the number of threads to use for the application\n");
-            printf("   make sure that you a valid number of threads. \n");
-            printf("\n");
-            printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n\n");
-            exit(1);
-         }
-      }
+   while(1) {
+      waitBarrier(&phaseBarrier, id);
+      if (poolJob == NULL)
+         break;
+      poolJob(id);
+      waitBarrier(&phaseBarrier, id);
    }
 
+   return NULL;
+}
 
-   // allocate space for theads and set up slitting
-   allocateThreads();
+// run job on every thread, the calling thread is thread 0
+void runPool(void (*job)(int)) {
 
-   // allocate space for arrays to store boid position and velocity
-   allocateArrays();
+   poolJob = job;
+   waitBarrier(&phaseBarrier, 0);
+   if (job == NULL)
+      return;
+   job(0);
+   waitBarrier(&phaseBarrier, 0);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// -s knn moves each boid away from only its nearest neighbours within
+// 5.0. the boids are binned into a grid every iteration, hashed into
+// buckets so the grid can be as large as the flock needs, and rule 2
+// searches outwards from each boid's cell one ring of cells at a time
+// until the nearest neighbours are known. cells are sized from the
+// flock's density so a search looks at a few cells rather than every
+// boid within 5.0
+
+
+// bucket of the cell at x,y,z
+int cellBucket(int x, int y, int z) {
+   return(((unsigned)x * 73856093u ^ (unsigned)y * 19349663u ^ (unsigned)z * 83492791u)
+      & (bucketsize - 1));
+}
+
+// bin the boids into the grid, every thread bins its own split
+void gridJob(int id) {
+
+   // variables
+   int i, k;
+   int first, last;
+   int start;
+   float volume;
+   float low[3];
+   float high[3];
+   struct gridPart *part = &gridParts[id];
+
+
+   // bounding box of this thread's boids, and clear its buckets
+   for(k=0; k<3; k++) {
+      part->bounds[k] = FLT_MAX;
+      part->bounds[3 + k] = -FLT_MAX;
+   }
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++)
+      for(k=0; k<3; k++) {
+         part->bounds[k] = fminf(part->bounds[k], boidArray[i][BX + k]);
+         part->bounds[3 + k] = fmaxf(part->bounds[3 + k], boidArray[i][BX + k]);
+      }
+
+   first = (long)bucketsize * id / threadsize;
+   last = (long)bucketsize * (id + 1) / threadsize;
+   for(i=first; i<last; i++)
+      atomic_store_explicit(&bucketFill[i], 0, memory_order_relaxed);
+
+   waitBarrier(&phaseBarrier, id);
+
+   // every thread works out the same grid from the whole bounding box
+   for(k=0; k<3; k++) {
+      low[k] = FLT_MAX;
+      high[k] = -FLT_MAX;
+   }
+   for(i=0; i<threadsize; i++)
+      for(k=0; k<3; k++) {
+         low[k] = fminf(low[k], gridParts[i].bounds[k]);
+         high[k] = fmaxf(high[k], gridParts[i].bounds[3 + k]);
+      }
+   volume = 1.0;
+   for(k=0; k<3; k++)
+      volume *= fmaxf(high[k] - low[k], MINCELL);
+   if (id == 0) {
+      cellSize = cbrtf(volume / popsize * neighbours * CELLFILL);
+      cellSize = fminf(fmaxf(cellSize, 5.0 / SEARCHRINGS), 5.0);
+      for(k=0; k<3; k++)
+         gridOrigin[k] = low[k];
+   }
+   waitBarrier(&phaseBarrier, id);
+
+   // count the boids of every bucket
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++) {
+      for(k=0; k<3; k++)
+         cellCoord[i][k] = (int)((boidArray[i][BX + k] - gridOrigin[k]) / cellSize);
+      boidBucket[i] = cellBucket(cellCoord[i][0], cellCoord[i][1], cellCoord[i][2]);
+      atomic_fetch_add_explicit(&bucketFill[boidBucket[i]], 1, memory_order_relaxed);
+   }
+   waitBarrier(&phaseBarrier, id);
+
+   // each thread adds up its range of buckets, then finds where each of
+   // its buckets starts from the ranges before it
+   part->count = 0;
+   for(i=first; i<last; i++)
+      part->count += atomic_load_explicit(&bucketFill[i], memory_order_relaxed);
+   waitBarrier(&phaseBarrier, id);
+
+   start = 0;
+   for(k=0; k<id; k++)
+      start += gridParts[k].count;
+   for(i=first; i<last; i++) {
+      bucketStart[i] = start;
+      start += atomic_load_explicit(&bucketFill[i], memory_order_relaxed);
+      atomic_store_explicit(&bucketFill[i], bucketStart[i], memory_order_relaxed);
+   }
+   if (id == threadsize - 1)
+      bucketStart[bucketsize] = popsize;
+   waitBarrier(&phaseBarrier, id);
+
+   // place every boid in its bucket, the order inside a bucket does not
+   // matter because rule 2 sorts the neighbours it finds
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++)
+      sortedBoids[atomic_fetch_add_explicit(&bucketFill[boidBucket[i]], 1, memory_order_relaxed)] = i;
+}
+
+// rule 2 for boids min to max using the grid
+void knnRule2(int id, int min, int max, float **update, int add) {
+
+   // variables
+   int i, j, k, n;
+   int b, slot;
+   int ring;
+   int rings;
+   int cell[3];
+   int x, y, z;
+   int found;
+   int nearest[MAXNEIGHBOURS];
+   float range[MAXNEIGHBOURS];
+   float d;
+   float cx, cy, cz;
+   long scanned;
+   long used;
+   long touched;
+   double nearestSum;
+
+
+   scanned = 0;
+   used = 0;
+   touched = 0;
+   nearestSum = 0.0;
+
+   // no cell further out than this can hold a boid within 5.0
+   rings = (int)ceilf(5.0 / cellSize);
+
+   for(i=min; i<max; i++) {
+      found = 0;
+      for(k=0; k<3; k++)
+         cell[k] = cellCoord[i][k];
+
+      for(ring=0; ring<=rings; ring++) {
+
+         // cells on the surface of the cube ring cells out
+         for(x=cell[0]-ring; x<=cell[0]+ring; x++)
+         for(y=cell[1]-ring; y<=cell[1]+ring; y++)
+         for(z=cell[2]-ring; z<=cell[2]+ring; z++) {
+            if (abs(x - cell[0]) != ring && abs(y - cell[1]) != ring && abs(z - cell[2]) != ring)
+               continue;
+            b = cellBucket(x, y, z);
+            for(slot=bucketStart[b]; slot<bucketStart[b+1]; slot++) {
+               j = sortedBoids[slot];
+               // other cells can share the bucket
+               if (j == i || cellCoord[j][0] != x || cellCoord[j][1] != y || cellCoord[j][2] != z)
+                  continue;
+               scanned++;
+               d = distance(i, j);
+               if (d >= 5.0)
+                  continue;
+
+               // keep the nearest, ties go to the lower index so the
+               // result does not depend on the order of a bucket
+               if (found == neighbours && (d > range[found-1]
+                || (d == range[found-1] && j > nearest[found-1])))
+                  continue;
+               if (found < neighbours)
+                  found++;
+               for(n=found-1; n>0 && (range[n-1] > d
+                || (range[n-1] == d && nearest[n-1] > j)); n--) {
+                  range[n] = range[n-1];
+                  nearest[n] = nearest[n-1];
+               }
+               range[n] = d;
+               nearest[n] = j;
+            }
+         }
+
+         // boids in the next ring are at least ring cells away
+         if (found == neighbours && range[found-1] < ring * cellSize)
+            break;
+      }
+
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(n=0; n<found; n++) {
+         j = nearest[n];
+         cx = cx - (boidArray[j][BX] - boidArray[i][BX]);
+         cy = cy - (boidArray[j][BY] - boidArray[i][BY]);
+         cz = cz - (boidArray[j][BZ] - boidArray[i][BZ]);
+      }
+      used += found;
+
+      // range is sorted so the nearest is first
+      if (found > 0) {
+         touched++;
+         nearestSum += range[0];
+      }
+
+      if (add) {
+         update[i][BX] += cx;
+         update[i][BY] += cy;
+         update[i][BZ] += cz;
+      } else {
+         update[i][BX] = cx;
+         update[i][BY] = cy;
+         update[i][BZ] = cz;
+      }
+   }
+
+   gridParts[id].scanned += scanned;
+   gridParts[id].used += used;
+   if (metricsTick)
+      addMetrics(id, touched, used, nearestSum);
+}
+
+// allocate the grid, twice as many buckets as boids
+void allocateGrid() {
+
+   for(bucketsize = 1; bucketsize < 2 * popsize; bucketsize *= 2)
+      ;
+   bucketFill = malloc(sizeof(atomic_int) * bucketsize);
+   bucketStart = malloc(sizeof(int) * (bucketsize + 1));
+   sortedBoids = malloc(sizeof(int) * popsize);
+   cellCoord = malloc(sizeof(int) * 3 * popsize);
+   boidBucket = malloc(sizeof(int) * popsize);
+   if (bucketFill == NULL || bucketStart == NULL || sortedBoids == NULL
+    || cellCoord == NULL || boidBucket == NULL) {
+      printf("Unable to allocate a grid for %d boids\n", popsize);
+      exit(1);
+   }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// -s sweep keeps the boids themselves sorted along one axis. a boid
+// within 5.0 of another is also within 5.0 along that axis, so rule 2
+// only has to scan the boids whose index is inside that window. the
+// flock moves little between iterations so an insertion sort puts it
+// back in order in close to one pass. rule 2 takes SWEEPLANES boids that
+// are next to each other in the order at a time and scans the window
+// that covers all of them, each boid in its own SIMD lane.
+// the sort runs on thread 0 alone while the others wait, O(N) a tick
+// and O(N log N) when the axis changes. the boids change places in
+// boidArray, so the flock sums and rule 2 add them up in a different
+// order from -s exact and the results match it within float rounding
+
+
+// order boids by sweepAxis, for qsort() when the axis changes
+int compareSweep(const void *a, const void *b) {
+
+   // variables
+   float ka = ((const float *)a)[sweepAxis];
+   float kb = ((const float *)b)[sweepAxis];
+
+   return((ka > kb) - (ka < kb));
+}
+
+// sort the boids along the axis of greatest spread and copy their
+// positions into sweepPosition
+void sweepJob(int id) {
+
+   // variables
+   int i, j, k;
+   int axis;
+   float low[3];
+   float high[3];
+   float boid[6];
+   struct gridPart *part = &gridParts[id];
+
+
+   for(k=0; k<3; k++) {
+      part->bounds[k] = FLT_MAX;
+      part->bounds[3 + k] = -FLT_MAX;
+   }
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++)
+      for(k=0; k<3; k++) {
+         part->bounds[k] = fminf(part->bounds[k], boidArray[i][BX + k]);
+         part->bounds[3 + k] = fmaxf(part->bounds[3 + k], boidArray[i][BX + k]);
+      }
+   waitBarrier(&phaseBarrier, id);
+
+   // one thread sorts, moving whole rows of boidStorage
+   if (id == 0) {
+      for(k=0; k<3; k++) {
+         low[k] = FLT_MAX;
+         high[k] = -FLT_MAX;
+      }
+      for(i=0; i<threadsize; i++)
+         for(k=0; k<3; k++) {
+            low[k] = fminf(low[k], gridParts[i].bounds[k]);
+            high[k] = fmaxf(high[k], gridParts[i].bounds[3 + k]);
+         }
+      axis = BX;
+      for(k=1; k<3; k++)
+         if (high[k] - low[k] > high[axis] - low[axis])
+            axis = k;
+      if (sweepAxis >= 0 && high[axis] - low[axis]
+       <= SWEEPSWITCH * (high[sweepAxis] - low[sweepAxis]))
+         axis = sweepAxis;
+
+      // a new axis starts from scratch, otherwise the order is nearly
+      // right already
+      if (axis != sweepAxis) {
+         sweepAxis = axis;
+         qsort(boidStorage, popsize, sizeof(float) * 6, compareSweep);
+      } else {
+         for(i=1; i<popsize; i++) {
+            if (boidArray[i-1][axis] <= boidArray[i][axis])
+               continue;
+            memcpy(boid, boidArray[i], sizeof(float) * 6);
+            for(j=i; j>0 && boidArray[j-1][axis] > boid[axis]; j--)
+               memcpy(boidArray[j], boidArray[j-1], sizeof(float) * 6);
+            memcpy(boidArray[j], boid, sizeof(float) * 6);
+         }
+      }
+   }
+   waitBarrier(&phaseBarrier, id);
+
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++)
+      for(k=0; k<3; k++)
+         sweepPosition[k][i] = boidArray[i][BX + k];
+}
+
+// rule 2 for boids min to max, scanning only the window along sweepAxis
+void sweepRule2(int id, int min, int max, float **update, int add) {
+
+   // variables
+   int i, j, l;
+   int lanes;
+   int low, high;
+   float *key = sweepPosition[sweepAxis];
+   float *px = sweepPosition[BX];
+   float *py = sweepPosition[BY];
+   float *pz = sweepPosition[BZ];
+   float bx[SWEEPLANES], by[SWEEPLANES], bz[SWEEPLANES];
+   float cx[SWEEPLANES], cy[SWEEPLANES], cz[SWEEPLANES];
+   float dx, dy, dz;
+   float d;
+   float near[SWEEPLANES];
+   int touching[SWEEPLANES];
+   int other;
+   long scanned;
+   long touched;
+   long contacts;
+   double nearestSum;
+
+
+   scanned = 0;
+   touched = 0;
+   contacts = 0;
+   nearestSum = 0.0;
+
+   for(i=min; i<max; i+=SWEEPLANES) {
+      lanes = max - i < SWEEPLANES ? max - i : SWEEPLANES;
+
+      // lanes past max repeat the last boid and are not stored
+      for(l=0; l<SWEEPLANES; l++) {
+         bx[l] = px[i + (l < lanes ? l : lanes - 1)];
+         by[l] = py[i + (l < lanes ? l : lanes - 1)];
+         bz[l] = pz[i + (l < lanes ? l : lanes - 1)];
+         cx[l] = 0.0; cy[l] = 0.0; cz[l] = 0.0;
+      }
+
+      // the window reaches 5.0 below the first boid and 5.0 above the
+      // last, it holds every boid that can be within 5.0 of any lane
+      low = i;
+      while(low > 0 && (d = key[low-1] - key[i], d * d < SEPARATION2))
+         low--;
+      high = i + lanes;
+      while(high < popsize && (d = key[high] - key[i + lanes - 1], d * d < SEPARATION2))
+         high++;
+      scanned += (long)(high - low) * lanes;
+
+      // a boid's own position gives a difference of 0 and adds nothing,
+      // as do boids further than 5.0
+      if (!metricsTick)
+      for(j=low; j<high; j++) {
+         for(l=0; l<SWEEPLANES; l++) {
+            dx = px[j] - bx[l];
+            dy = py[j] - by[l];
+            dz = pz[j] - bz[l];
+            d = dx * dx + dy * dy + dz * dz;
+            cx[l] -= d < SEPARATION2 ? dx : 0.0f;
+            cy[l] -= d < SEPARATION2 ? dy : 0.0f;
+            cz[l] -= d < SEPARATION2 ? dz : 0.0f;
+         }
+      }
+
+      // the same loop that also counts the boids each lane moves away
+      // from and keeps the nearest, for the metrics stream
+      if (metricsTick) {
+         for(l=0; l<SWEEPLANES; l++) {
+            near[l] = SEPARATION2;
+            touching[l] = 0;
+         }
+         for(j=low; j<high; j++) {
+            for(l=0; l<SWEEPLANES; l++) {
+               dx = px[j] - bx[l];
+               dy = py[j] - by[l];
+               dz = pz[j] - bz[l];
+               d = dx * dx + dy * dy + dz * dz;
+               cx[l] -= d < SEPARATION2 ? dx : 0.0f;
+               cy[l] -= d < SEPARATION2 ? dy : 0.0f;
+               cz[l] -= d < SEPARATION2 ? dz : 0.0f;
+               other = d < SEPARATION2 && j != i + l;
+               touching[l] += other;
+               near[l] = other ? fminf(near[l], d) : near[l];
+            }
+         }
+         for(l=0; l<lanes; l++) {
+            if (touching[l] > 0) {
+               touched++;
+               contacts += touching[l];
+               nearestSum += sqrtf(near[l]);
+            }
+         }
+      }
+
+      for(l=0; l<lanes; l++) {
+         if (add) {
+            update[i + l][BX] += cx[l];
+            update[i + l][BY] += cy[l];
+            update[i + l][BZ] += cz[l];
+         } else {
+            update[i + l][BX] = cx[l];
+            update[i + l][BY] = cy[l];
+            update[i + l][BZ] = cz[l];
+         }
+      }
+   }
+
+   gridParts[id].scanned += scanned;
+   if (metricsTick)
+      addMetrics(id, touched, contacts, nearestSum);
+}
+
+// allocate the position arrays for -s sweep
+void allocateSweep() {
+
+   // variables
+   int k;
+
+
+   for(k=0; k<3; k++) {
+      if (posix_memalign((void**)&sweepPosition[k], 64, sizeof(float) * popsize) != 0) {
+         printf("Unable to allocate %d boids\n", popsize);
+         exit(1);
+      }
+   }
+
+   // the first sweepJob() picks an axis and sorts from scratch
+   sweepAxis = -1;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// -s sampled looks at a random sampleRate of each boid's sweep window
+// and scales the sum up by the size of the window over the number of
+// samples, which on average gives the exact rule 2. the samples come
+// from counterRandom() so they only depend on the iteration, the boid
+// and the draw, not on the threads or the order boids are run in
+
+
+// counter based random number, mixes key and counter with the
+// splitmix64 finaliser so every pair gives an unrelated 64 bit number
+unsigned long counterRandom(unsigned long key, unsigned long counter) {
+
+   // variables
+   unsigned long x;
+   int round;
+
+
+   x = key;
+   for(round=0; round<2; round++) {
+      x += counter * 0x9e3779b97f4a7c15UL;
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+      x ^= x >> 31;
+   }
+   return(x);
+}
+
+// rule 2 of boid i from the boids low to high-1 of the sweep order,
+// returns the number of other boids within 5.0 and leaves the squared
+// distance to the nearest of them in near
+int windowRule2(int i, int low, int high, float sum[3], float *near) {
+
+   // variables
+   int j;
+   int touching;
+   float dx, dy, dz;
+   float d;
+
+
+   sum[0] = 0.0; sum[1] = 0.0; sum[2] = 0.0;
+   touching = 0;
+   *near = SEPARATION2;
+   for(j=low; j<high; j++) {
+      if (j == i)
+         continue;
+      dx = sweepPosition[BX][j] - sweepPosition[BX][i];
+      dy = sweepPosition[BY][j] - sweepPosition[BY][i];
+      dz = sweepPosition[BZ][j] - sweepPosition[BZ][i];
+      d = dx * dx + dy * dy + dz * dz;
+      if (d < SEPARATION2) {
+         sum[0] -= dx;
+         sum[1] -= dy;
+         sum[2] -= dz;
+         touching++;
+         *near = fminf(*near, d);
+      }
+   }
+   return(touching);
+}
+
+// rule 2 for boids min to max from samples of their sweep windows.
+// about SAMPLECHECKS boids an iteration are also run exactly and the
+// difference added to the thread's samplePart
+void sampledRule2(int id, int min, int max, float **update, int add) {
+
+   // variables
+   int i, j, k, s;
+   int low, high;
+   int window, samples;
+   float *key = sweepPosition[sweepAxis];
+   float sum[3], exact[3];
+   float dx, dy, dz;
+   float d, scale;
+   float near, exactNear;
+   int touching;
+   unsigned long boidKey;
+   unsigned long checkBelow;
+   long scanned;
+   long touched;
+   double contacts;
+   double nearestSum;
+   struct samplePart *part = &sampleParts[id];
+
+
+   scanned = 0;
+   touched = 0;
+   contacts = 0.0;
+   nearestSum = 0.0;
+   low = min;
+   high = min;
+   checkBelow = popsize > SAMPLECHECKS ? ULONG_MAX / popsize * SAMPLECHECKS : ULONG_MAX;
+
+   for(i=min; i<max; i++) {
+
+      // the keys are sorted so both ends of the window only move up with
+      // i, the first boid walks out to them and the rest step them along
+      if (i == min) {
+         low = i;
+         while(low > 0 && (d = key[low-1] - key[i], d * d < SEPARATION2))
+            low--;
+         high = i + 1;
+      } else {
+         while(low < i && (d = key[low] - key[i], d * d >= SEPARATION2))
+            low++;
+         if (high < i + 1)
+            high = i + 1;
+      }
+      while(high < popsize && (d = key[high] - key[i], d * d < SEPARATION2))
+         high++;
+      window = high - low;
+      samples = (int)ceil(sampleRate * window);
+
+      // small windows are cheaper to run in full
+      boidKey = (unsigned long)flockCount << 32 | (unsigned int)i;
+      if (samples >= window) {
+         touching = windowRule2(i, low, high, sum, &near);
+         scale = 1.0;
+         scanned += window;
+      } else {
+         sum[0] = 0.0; sum[1] = 0.0; sum[2] = 0.0;
+         touching = 0;
+         near = SEPARATION2;
+         for(s=0; s<samples; s++) {
+            j = low + (int)((counterRandom(boidKey, s) >> 32) * window >> 32);
+            dx = sweepPosition[BX][j] - sweepPosition[BX][i];
+            dy = sweepPosition[BY][j] - sweepPosition[BY][i];
+            dz = sweepPosition[BZ][j] - sweepPosition[BZ][i];
+            d = dx * dx + dy * dy + dz * dz;
+            if (d < SEPARATION2) {
+               sum[0] -= dx;
+               sum[1] -= dy;
+               sum[2] -= dz;
+               if (j != i) {
+                  touching++;
+                  near = fminf(near, d);
+               }
+            }
+         }
+         scale = (float)window / samples;
+         for(k=0; k<3; k++)
+            sum[k] *= scale;
+         scanned += samples;
+
+         // the last counter is never a sample, it picks the boids to check
+         if (counterRandom(boidKey, ULONG_MAX) < checkBelow) {
+            windowRule2(i, low, high, exact, &exactNear);
+            for(k=0; k<3; k++) {
+               part->errorSum += (double)(sum[k] - exact[k]) * (sum[k] - exact[k]);
+               part->exactSum += (double)exact[k] * exact[k];
+            }
+            part->checked++;
+         }
+      }
+
+      for(k=0; k<3; k++) {
+         if (add)
+            update[i][BX + k] += sum[k];
+         else
+            update[i][BX + k] = sum[k];
+      }
+
+      // the metrics stream gets the same estimates as the force, the
+      // nearest is only the nearest of the samples
+      if (touching > 0) {
+         touched++;
+         contacts += touching * scale;
+         nearestSum += sqrtf(near);
+      }
+   }
+
+   gridParts[id].scanned += scanned;
+   if (metricsTick)
+      addMetrics(id, touched, contacts, nearestSum);
+}
+
+#ifndef NOGRAPHICS
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// the density view counts boids per screen cell on the pool threads.
+// each thread counts its own split into its own copy of the screen so
+// no counts are shared, then after a barrier each thread adds up every
+// thread's count for its share of the cells and turns it into a level
+// of DENSITYGLYPHS
+
+
+// level of DENSITYGLYPHS for a cell holding count boids
+int densityLevel(int count) {
+
+   // variables
+   int level;
+
+   for(level = 0; count > 0 && level < DENSITYLEVELS - 1; level++)
+      count = count >> 1;
+   return(level);
+}
+
+// count the boids of thread id's split, then reduce its share of cells
+void densityJob(int id) {
+
+   // variables
+   int i, k;
+   int row, col;
+   int cells;
+   int first, last;
+   int count;
+   int *counts;
+
+
+   cells = frameRows * frameCols;
+   counts = &cellCounts[(long)id * cells];
+
+   memset(counts, 0, sizeof(int) * cells);
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++) {
+      row = (int)(boidArray[i][BX]*cellMulty);
+      col = (int)(boidArray[i][BY]*cellMultx);
+      if (row >= 0 && row < frameRows && col >= 0 && col < frameCols)
+         counts[row * frameCols + col]++;
+   }
+
+   // every thread's counts are needed before any cell can be added up
+   waitBarrier(&phaseBarrier, id);
+
+   first = (long)cells * id / threadsize;
+   last = (long)cells * (id + 1) / threadsize;
+   for(i=first; i<last; i++) {
+      count = 0;
+      for(k=0; k<threadsize; k++)
+         count += cellCounts[(long)k * cells + i];
+      frameCells[i] = densityLevel(count);
+   }
+}
+
+// fill frameCells with the density level of every cell
+void densityCells() {
+
+   // variables
+   long size;
+
+
+   // the screen or the number of threads may have changed since the
+   // counts were allocated
+   size = (long)threadsize * frameRows * frameCols;
+   if (size != countSize) {
+      free(cellCounts);
+      cellCounts = malloc(sizeof(int) * size);
+      if (cellCounts == NULL) {
+         endwin();
+         printf("Unable to allocate the density view\n");
+         exit(1);
+      }
+      countSize = size;
+   }
+
+   runPool(densityJob);
+}
+#endif
+
+#ifdef NOGRAPHICS
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// the timing build can save frames as images instead of drawing with
+// curses. every thread splats its own split into its own copy of the
+// frame, looking down the z axis with boids near the top drawn red and
+// boids near the bottom drawn blue. after a barrier each thread adds up
+// every copy for its share of the rows and tone maps them to bytes. a
+// writer thread saves the finished frame while the boids move on
+
+
+// splat thread id's boids, then reduce and tone map its rows
+void frameJob(int id) {
+
+   // variables
+   int i, k;
+   int row, col;
+   int first, last;
+   long pixels;
+   float *light;
+   float depth;
+   float sum;
+   float scale;
+   unsigned char *out;
+
+
+   pixels = (long)frameSize * frameSize;
+   light = &frameLight[id * pixels * 3];
+   memset(light, 0, sizeof(float) * 3 * pixels);
+
+   // the view is twice the starting area so the flock stays in frame
+   scale = frameSize / (2.0 * SCREENSIZE);
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++) {
+      row = (int)((boidArray[i][BX] + SCREENSIZE / 2) * scale);
+      col = (int)((boidArray[i][BY] + SCREENSIZE / 2) * scale);
+      if (row < 0 || row >= frameSize || col < 0 || col >= frameSize)
+         continue;
+      depth = (boidArray[i][BZ] + SCREENSIZE / 2) / (2.0 * SCREENSIZE);
+      depth = fminf(fmaxf(depth, 0.0), 1.0);
+      light[(row * frameSize + col) * 3 + 0] += depth;
+      light[(row * frameSize + col) * 3 + 1] += 0.5;
+      light[(row * frameSize + col) * 3 + 2] += 1.0 - depth;
+   }
+
+   // every thread's splats are needed before any pixel can be added up
+   waitBarrier(&phaseBarrier, id);
+
+   first = frameSize * id / threadsize;
+   last = frameSize * (id + 1) / threadsize;
+   out = framePixels[frameFill];
+   for(i=first * frameSize * 3; i<last * frameSize * 3; i++) {
+      sum = 0.0;
+      for(k=0; k<threadsize; k++)
+         sum += frameLight[k * pixels * 3 + i];
+      // one boid gives a dim pixel, a crowd saturates
+      out[i] = (unsigned char)(255.0 * (1.0 - expf(-sum)));
+   }
+}
+
+// save frames handed over by drawFrame() until told to stop
+void *writeFrames(void *data) {
+
+   // variables
+   int frame;
+   int number;
+   char name[PATH_MAX];
+   FILE *fp;
+
+   // the frames to write are in the frame globals
+   (void)data;
+
+   pthread_mutex_lock(&frameMutex);
+   while(1) {
+      while(frameQueued < 0 && !frameStop)
+         pthread_cond_wait(&frameCond, &frameMutex);
+      if (frameQueued < 0)
+         break;
+      frame = frameQueued;
+      number = frameNumber;
+      pthread_mutex_unlock(&frameMutex);
+
+      snprintf(name, sizeof(name), "%s%05d.ppm", framePrefix, number);
+      fp = fopen(name, "wb");
+      if (fp == NULL) {
+         printf("Unable to write %s\n", name);
+         exit(1);
+      }
+      fprintf(fp, "P6\n%d %d\n255\n", frameSize, frameSize);
+      fwrite(framePixels[frame], 1, (size_t)frameSize * frameSize * 3, fp);
+      fclose(fp);
+
+      pthread_mutex_lock(&frameMutex);
+      frameQueued = -1;
+      pthread_cond_broadcast(&frameCond);
+   }
+   pthread_mutex_unlock(&frameMutex);
+
+   return(NULL);
+}
+
+// draw the current positions and hand the frame to the writer
+void drawFrame() {
+
+   // variables
+   struct timespec drawStart;
+   struct timespec drawEnd;
+
+
+   clock_gettime(CLOCK_MONOTONIC, &drawStart);
+   runPool(frameJob);
+   clock_gettime(CLOCK_MONOTONIC, &drawEnd);
+   frameTime += secondsBetween(&drawStart, &drawEnd);
+
+   // the writer can only hold one frame, the next one is drawn into the
+   // other buffer
+   pthread_mutex_lock(&frameMutex);
+   while(frameQueued >= 0)
+      pthread_cond_wait(&frameCond, &frameMutex);
+   frameQueued = frameFill;
+   frameNumber++;
+   pthread_cond_broadcast(&frameCond);
+   pthread_mutex_unlock(&frameMutex);
+   frameFill = 1 - frameFill;
+
+   clock_gettime(CLOCK_MONOTONIC, &drawStart);
+   frameWait += secondsBetween(&drawEnd, &drawStart);
+}
+
+// allocate the frames and start the writer
+void startFrames() {
+
+   frameLight = malloc(sizeof(float) * 3 * threadsize * (size_t)frameSize * frameSize);
+   framePixels[0] = malloc((size_t)frameSize * frameSize * 3);
+   framePixels[1] = malloc((size_t)frameSize * frameSize * 3);
+   if (frameLight == NULL || framePixels[0] == NULL || framePixels[1] == NULL) {
+      printf("Unable to allocate %d by %d frames\n", frameSize, frameSize);
+      exit(1);
+   }
+
+   frameFill = 0;
+   frameQueued = -1;
+   frameStop = 0;
+   frameNumber = -1;
+   frameTime = 0.0;
+   frameWait = 0.0;
+   pthread_mutex_init(&frameMutex, NULL);
+   pthread_cond_init(&frameCond, NULL);
+   pthread_create(&frameWriter, NULL, writeFrames, NULL);
+}
+
+// wait for the last frame to be saved
+void stopFrames() {
+
+   pthread_mutex_lock(&frameMutex);
+   frameStop = 1;
+   pthread_cond_broadcast(&frameCond);
+   pthread_mutex_unlock(&frameMutex);
+   pthread_join(frameWriter, NULL);
+
+   free(frameLight);
+   free(framePixels[0]);
+   free(framePixels[1]);
+}
+#endif
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// the bounded staleness engine drops the barriers. every block runs its
+// own iterations and after each one publishes a snapshot of its positions
+// and sums. a block on iteration t reads the newest snapshot of every
+// other block that is no newer than t, and only waits when another block
+// is more than staleness iterations behind. with a staleness of 0 this
+// gives the same result as the data engine.
+
+
+// direction moveFlock() pulls on iteration t, as moveBoids() does it
+int flockSignAt(int t) {
+   return((t / 200) % 2 == 0 ? -1 : 1);
+}
+
+// rule 2 reading other boids from the snapshots in versions
+void asyncRule2(int min, int max, int *versions) {
+
+   // variables
+   int i, j, k;
+   float cx, cy, cz;
+   float dx, dy, dz;
+   float *snapshot;
+
+   // keep boids from overlapping
+   for(i=min; i<max; i++) {
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(k=0; k<threadsize; k++) {
+         snapshot = &asyncPositions[(long)(versions[k] % ringsize) * popsize * 3];
+         for(j=splitArray[k][0]; j<splitArray[k][1]; j++) {
+            if (i != j) {		// calculate when not the same boid
+               dx = snapshot[j*3 + BX] - boidArray[i][BX];
+               dy = snapshot[j*3 + BY] - boidArray[i][BY];
+               dz = snapshot[j*3 + BZ] - boidArray[i][BZ];
+               if (sqrtf(powf(dx,2.0) + powf(dy,2.0) + powf(dz,2.0)) < 5.0) {
+                  cx = cx - dx;
+                  cy = cy - dy;
+                  cz = cz - dz;
+               }
+            }
+         }
+      }
+      boidUpdate[i][BX] += cx;
+      boidUpdate[i][BY] += cy;
+      boidUpdate[i][BZ] += cz;
+   }
+}
+
+// copy block id's positions and sums into the snapshot for version,
+// summed is 1 when updateBoids() has just left the sums in partialSums
+void publishBlock(int id, int version, int summed) {
+
+   // variables
+   int i, k;
+   float *snapshot;
+
+
+   snapshot = &asyncPositions[(long)(version % ringsize) * popsize * 3];
+   for(i=splitArray[id][0]; i<splitArray[id][1]; i++) {
+      snapshot[i*3 + BX] = boidArray[i][BX];
+      snapshot[i*3 + BY] = boidArray[i][BY];
+      snapshot[i*3 + BZ] = boidArray[i][BZ];
+   }
+
+   if (!summed)
+      sumBoids(id, splitArray[id][0], splitArray[id][1]);
+   for(k=0; k<6; k++)
+      asyncSums[(version % ringsize) * threadsize + id][k] = partialSums[id].sum[k];
+
+   // other blocks may read the snapshot once they see the new version
+   atomic_store_explicit(&asyncBlocks[id].published, version, memory_order_release);
+}
+
+// asyncIterations iterations of block id without barriers
+void asyncJob(int id) {
+
+   // variables
+   int t, k;
+   int v;
+   int spins;
+   int min;
+   int max;
+   int *versions;
+   float sums[6];
+   struct timespec waitStart;
+   struct timespec waitEnd;
+
+
+   min = splitArray[id][0];
+   max = splitArray[id][1];
+   versions = malloc(sizeof(int) * threadsize);
+
+   for(t = asyncFirst; t < asyncFirst + asyncIterations; t++) {
+
+      // pick the snapshot of every block, waiting for blocks that are
+      // too far behind
+      for(k=0; k<threadsize; k++) {
+         v = atomic_load_explicit(&asyncBlocks[k].published, memory_order_acquire);
+         if (v < t - staleness) {
+            clock_gettime(CLOCK_MONOTONIC, &waitStart);
+            for(spins = 0; v < t - staleness; spins++) {
+               if (waitSpins < 0 || spins < waitSpins)
+                  cpuRelax();
+               else
+                  sched_yield();
+               v = atomic_load_explicit(&asyncBlocks[k].published, memory_order_acquire);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &waitEnd);
+            asyncStats[id].waitTime += secondsBetween(&waitStart, &waitEnd);
+         }
+         versions[k] = v < t ? v : t;
+
+         if (k != id) {
+            asyncStats[id].stalenessSum += t - versions[k];
+            asyncStats[id].stalenessReads++;
+            if (t - versions[k] > asyncStats[id].stalenessMax)
+               asyncStats[id].stalenessMax = t - versions[k];
+         }
+      }
+
+      // sums of the whole flock from the same snapshots
+      for(k=0; k<6; k++)
+         sums[k] = 0.0;
+      for(k=0; k<threadsize; k++)
+         for(v=0; v<6; v++)
+            sums[v] += asyncSums[(versions[k] % ringsize) * threadsize + k][v];
+
+      rule1(min, max, sums);
+      asyncRule2(min, max, versions);
+      rule3(min, max, sums);
+      moveFlock(min, max, flockSignAt(t));
+      updateBoids(id, min, max);
+
+      publishBlock(id, t + 1, 1);
+   }
+
+   free(versions);
+}
+
+// run iterations of the bounded staleness engine
+void runAsync(int iterations) {
+
+   // variables
+   int k;
+
+
+   // every block starts from a snapshot of the current positions
+   for(k=0; k<threadsize; k++)
+      publishBlock(k, flockCount, 0);
+
+   asyncFirst = flockCount;
+   asyncIterations = iterations;
+   runPool(asyncJob);
+
+   flockCount += iterations;
+   flockSign = flockSignAt(flockCount - 1);
+}
+
+// allocate the snapshots of the bounded staleness engine
+void allocateAsync() {
+
+   // variables
+   int k;
+
+
+   ringsize = 2 * staleness + 2;
+   asyncPositions = malloc(sizeof(float) * 3 * popsize * ringsize);
+   asyncSums = malloc(sizeof(float) * 6 * threadsize * ringsize);
+   if (asyncPositions == NULL || asyncSums == NULL
+    || posix_memalign((void**)&asyncBlocks, 64, sizeof(struct asyncBlock) * threadsize) != 0
+    || posix_memalign((void**)&asyncStats, 64, sizeof(struct asyncStat) * threadsize) != 0) {
+      printf("Unable to allocate %d snapshots of %d boids\n", ringsize, popsize);
+      exit(1);
+   }
+
+   for(k=0; k<threadsize; k++) {
+      atomic_init(&asyncBlocks[k].published, 0);
+      asyncStats[k].stalenessSum = 0;
+      asyncStats[k].stalenessReads = 0;
+      asyncStats[k].stalenessMax = 0;
+      asyncStats[k].waitTime = 0.0;
+   }
+}
+
+// the compact modes store each value in 2 bytes, either as a half float
+// or as an int16 with a fixed scale. boidUpdate stays float and every
+// kernel widens the values it reads to float so the arithmetic is the
+// same as the float engine, only the stored state loses precision
+
+
+// value k of boid i widened to float
+float compactLoad(int i, int k) {
+#ifdef __FLT16_MAX__
+   if (precision == PRECISIONHALF)
+      return((float)halfStorage[i*6 + k]);
+#endif
+   if (k < VX)
+      return(fixedStorage[i*6 + k] / POSITIONSCALE);
+   return(fixedStorage[i*6 + k] / VELOCITYSCALE);
+}
+
+// store value k of boid i, narrowed to the compact mode
+void compactStore(int i, int k, float value) {
+
+   // variables
+   float scaled;
+
+
+#ifdef __FLT16_MAX__
+   if (precision == PRECISIONHALF) {
+      halfStorage[i*6 + k] = (_Float16)value;
+      return;
+   }
+#endif
+
+   // round to the nearest step and clamp to what int16 can hold
+   scaled = roundf(value * (k < VX ? POSITIONSCALE : VELOCITYSCALE));
+   if (scaled > SHRT_MAX || scaled < SHRT_MIN) {
+      scaled = scaled > 0 ? SHRT_MAX : SHRT_MIN;
+      atomic_fetch_add_explicit(&fixedClamps, 1, memory_order_relaxed);
+   }
+   fixedStorage[i*6 + k] = (short)scaled;
+}
+
+// sumBoids() reading the compact state, also widens the positions of
+// boids min to max into compactPositions
+void compactSums(int id, int min, int max) {
+
+   // variables
+   int i, k;
+   float sum[6];
+   float value;
+
+
+   for(k=0; k<6; k++)
+      sum[k] = 0.0;
+   for(i=min; i<max; i++)
+      for(k=0; k<6; k++) {
+         value = compactLoad(i, k);
+         if (k < VX)
+            compactPositions[i*3 + k] = value;
+         sum[k] += value;
+      }
+   for(k=0; k<6; k++)
+      partialSums[id].sum[k] = sum[k];
+}
+
+// rule 1, rule 2, rule 3 and moveFlock() for boids min to max reading the
+// compact state, the update is built in the same order as tickJob()
+void compactRules(int id, int min, int max, float *sums, int sign) {
+
+   // variables
+   int i, j, k;
+   float boid[6];
+   float *other;
+   float update[3];
+   float cx, cy, cz;
+   float pull;
+
+   // timing
+   struct timespec ruleStart;
+   struct timespec ruleEnd;
+
+
+   // moveFlock() pulls towards (40,40,40) or (60,60,60)
+   pull = (sign == 1) ? 40.0 : 60.0;
+
+   // rule 2 on the widened positions, timed once for the whole range
+   // for rebalanceThreads(). the result waits in boidUpdate
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ruleStart);
+   for(i=min; i<max; i++) {
+      for(k=0; k<3; k++)
+         boid[k] = compactPositions[i*3 + k];
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(j=0; j<popsize; j++) {
+         if (i != j) {		// calculate when not the same boid
+            other = &compactPositions[j*3];
+            if (sqrtf(
+                  powf(boid[BX] - other[BX],2.0) +
+                  powf(boid[BY] - other[BY],2.0) +
+                  powf(boid[BZ] - other[BZ],2.0) ) < 5.0) {
+               cx = cx - (other[BX] - boid[BX]);
+               cy = cy - (other[BY] - boid[BY]);
+               cz = cz - (other[BZ] - boid[BZ]);
+            }
+         }
+      }
+      boidUpdate[i][BX] = cx;
+      boidUpdate[i][BY] = cy;
+      boidUpdate[i][BZ] = cz;
+   }
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ruleEnd);
+   splitCost[id] += secondsBetween(&ruleStart, &ruleEnd);
+
+   for(i=min; i<max; i++) {
+      for(k=0; k<6; k++)
+         boid[k] = compactLoad(i, k);
+
+      // rule 1, then rule 2 from above
+      for(k=0; k<3; k++)
+         update[k] = (sums[BX + k] / popsize - boid[BX + k])/popsize;
+      for(k=0; k<3; k++)
+         update[k] += boidUpdate[i][BX + k];
+
+      // rule 3 and moveFlock()
+      for(k=0; k<3; k++)
+         update[k] += (sums[VX + k] / popsize - boid[VX + k])/8.0;
+      for(k=0; k<3; k++)
+         update[k] += (pull - boid[BX + k])/200.0;
+
+      boidUpdate[i][BX] = update[0];
+      boidUpdate[i][BY] = update[1];
+      boidUpdate[i][BZ] = update[2];
+   }
+}
+
+// updateBoids() on the compact state
+void compactUpdate(int min, int max) {
+
+   // variables
+   int i, k;
+   float velocity;
+
+
+   for(i=min; i<max; i++) {
+      for(k=0; k<3; k++) {
+         velocity = compactLoad(i, VX + k) + boidUpdate[i][BX + k];
+         compactStore(i, VX + k, velocity);
+         compactStore(i, BX + k, compactLoad(i, BX + k) + velocity);
+      }
+   }
+}
+
+// one iteration of the data engine on the compact state
+void compactJob(int id) {
+
+   // variables
+   int min;
+   int max;
+   float sums[6];
+
+
+   // assign
+   min = splitArray[id][0];
+   max = splitArray[id][1];
+
+   compactSums(id, min, max);
+   waitBarrier(&phaseBarrier, id);
+   flockSums(sums, threadsize);
+
+   compactRules(id, min, max, sums, flockSign);
+
+   waitBarrier(&phaseBarrier, id);
+   compactUpdate(min, max);
+}
+
+// allocate the compact state and fill it from boidArray
+void allocateCompact() {
+
+   // variables
+   int i, k;
+   int pages;
+   void *storage;
+
+
+   storage = allocatePages(sizeof(short) * 6 * popsize, pageMode, &pages);
+   if (storage == NULL) {
+      printf("Unable to allocate %d boids\n", popsize);
+      exit(1);
+   }
+#ifdef __FLT16_MAX__
+   halfStorage = storage;
+#endif
+   fixedStorage = storage;
+   atomic_init(&fixedClamps, 0);
+   compactPositions = malloc(sizeof(float) * 3 * popsize);
+   if (compactPositions == NULL) {
+      printf("Unable to allocate %d boids\n", popsize);
+      exit(1);
+   }
+
+   for(i=0; i<popsize; i++)
+      for(k=0; k<6; k++)
+         compactStore(i, k, boidArray[i][k]);
+}
+
+// compare the compact run with boidArray after the same iterations in
+// float, the error of each boid's position is its distance from the
+// float position
+void reportDrift() {
+
+   // variables
+   int i, k;
+   double error;
+   double squares;
+   double largest;
+   double centre[3];
+   double compactCentre[3];
+
+
+   squares = 0.0;
+   largest = 0.0;
+   for(k=0; k<3; k++) {
+      centre[k] = 0.0;
+      compactCentre[k] = 0.0;
+   }
+
+   for(i=0; i<popsize; i++) {
+      error = 0.0;
+      for(k=0; k<3; k++) {
+         error += pow(compactLoad(i, BX + k) - boidArray[i][BX + k], 2.0);
+         centre[k] += boidArray[i][BX + k];
+         compactCentre[k] += compactLoad(i, BX + k);
+      }
+      squares += error;
+      if (sqrt(error) > largest)
+         largest = sqrt(error);
+   }
+
+   error = 0.0;
+   for(k=0; k<3; k++)
+      error += pow((compactCentre[k] - centre[k]) / popsize, 2.0);
+
+   printf("Drift from float after %d iterations, rms %lf max %lf centre %lf\n",
+      flockCount, sqrt(squares / popsize), largest, sqrt(error));
+   if (precision == PRECISIONFIXED)
+      printf("Values clamped to the int16 range %ld\n", (long)atomic_load(&fixedClamps));
+}
+
+// move boids
+void moveBoids() {
+
+   // variables
+   struct timespec gridStart;
+   struct timespec gridEnd;
+
+
+   // the bounded staleness engine keeps its own iteration count
+   if (engine == ENGINEASYNC) {
+      runAsync(1);
+      return;
+   }
+
+   // every 200 iterations change point that flock is pulled towards.
+   // this is done here once instead of by every thread
+   if (flockCount % 200 == 0) {
+      flockSign = flockSign * -1;
+   }
+
+   // the hybrid engine needs a thread for each group, the compact modes
+   // only run in the data engine
+   if (precision != PRECISIONFLOAT) {
+      runPool(compactJob);
+#ifndef NOGRAPHICS
+      // drawBoids() reads boidArray
+      for(int i=0; i<popsize; i++)
+         for(int k=0; k<6; k++)
+            boidArray[i][k] = compactLoad(i, k);
+#endif
+   } else {
+      metricsTick = metricsFile != NULL && (flockCount + 1) % metricsEvery == 0;
+      if (profile) {
+         profileTicks++;
+         if (!sumsReady)
+            sumsTicks++;
+         clock_gettime(CLOCK_MONOTONIC, &gridStart);
+      }
+      if (separationMode == SEPARATIONKNN)
+         runPool(gridJob);
+      else if (separationMode == SEPARATIONSWEEP || separationMode == SEPARATIONSAMPLED)
+         runPool(sweepJob);
+      if (profile) {
+         clock_gettime(CLOCK_MONOTONIC, &gridEnd);
+         gridSeconds += (gridEnd.tv_sec - gridStart.tv_sec)
+            + (gridEnd.tv_nsec - gridStart.tv_nsec) / 1000000000.0;
+      }
+      if (engine == ENGINEHYBRID && threadsize > 1)
+         runPool(hybridJob);
+      else
+         runPool(tickJob);
+      sumsReady = 1;
+      if (profile)
+         countPairs();
+      if (metricsTick)
+         writeMetrics();
+      metricsTick = 0;
+   }
+
+   flockCount++;
+
+   // move the splits so each thread gets the same amount of rule 2 work,
+   // or in the hybrid engine the same amount of work in each group
+   if (engine == ENGINEHYBRID && threadsize > 1) {
+      if (groupRebalance > 0 && ++rebalanceCount >= groupRebalance)
+         rebalanceGroups();
+   } else if (rebalance > 0 && ++rebalanceCount >= rebalance)
+      rebalanceThreads();
+}
+
+
+// write a line of the metrics stream from what updateBoids() and rule 2
+// left on this iteration. cohesion is the root mean square distance
+// from the centre of mass, polarization the length of the mean velocity
+// over the mean speed, nearest the mean distance to the nearest boid of
+// the boids with one within 5.0, and contacts the boids rule 2 moved
+// each boid away from on average
+void writeMetrics() {
+
+   // variables
+   int i, k;
+   double sum[6];
+   double square, speed;
+   double nearestSum, contacts;
+   long touched;
+   double centre2, velocity2;
+
+
+   for(k=0; k<6; k++)
+      sum[k] = 0.0;
+   square = 0.0; speed = 0.0;
+   nearestSum = 0.0; contacts = 0.0; touched = 0;
+   for(i=0; i<threadsize; i++) {
+      for(k=0; k<6; k++)
+         sum[k] += partialSums[i].sum[k];
+      square += partialSums[i].square;
+      speed += partialSums[i].speed;
+      nearestSum += metricParts[i].nearestSum;
+      contacts += metricParts[i].contacts;
+      touched += metricParts[i].touched;
+      metricParts[i].nearestSum = 0.0;
+      metricParts[i].contacts = 0.0;
+      metricParts[i].touched = 0;
+   }
+
+   centre2 = 0.0; velocity2 = 0.0;
+   for(k=0; k<3; k++) {
+      centre2 += (sum[BX + k] / popsize) * (sum[BX + k] / popsize);
+      velocity2 += sum[VX + k] * sum[VX + k];
+   }
+   fprintf(metricsFile, "%d %.4f %.4f %.4f %.3f\n",
+      flockCount + 1,
+      sqrt(fmax(square / popsize - centre2, 0.0)),
+      speed > 0.0 ? sqrt(velocity2) / speed : 0.0,
+      touched > 0 ? nearestSum / touched : 0.0,
+      contacts / popsize);
+}
+
+// seconds on the monotonic clock
+double monotonicTime() {
+
+   // variables
+   struct timespec now;
+
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return(now.tv_sec + now.tv_nsec / 1000000000.0);
+}
+
+// number of neighbours rule 2 uses at a fidelity level above 0
+int fidelityNeighbours(int level) {
+   return((baseSeparation == SEPARATIONKNN ? baseNeighbours : MAXNEIGHBOURS) >> level);
+}
+
+// switch rule 2 to a fidelity level
+void setFidelity(int level) {
+   fidelity = level;
+   if (level == 0) {
+      separationMode = baseSeparation;
+      neighbours = baseNeighbours;
+   } else {
+      separationMode = SEPARATIONKNN;
+      neighbours = fidelityNeighbours(level);
+   }
+}
+
+// start the real time mode at full fidelity with the first tick due now
+void startRealTime() {
+   baseSeparation = separationMode;
+   baseNeighbours = neighbours;
+   for(fidelityLevels=1; fidelityLevels<FIDELITYMAX; fidelityLevels++)
+      if (fidelityNeighbours(fidelityLevels) < 1)
+         break;
+   setFidelity(0);
+   tickCost = 0.0;
+   fidelityHold = TICKHOLD;
+   recoverWait = TICKHOLD;
+   underBudget = 0;
+   movedUp = 0;
+   nextDeadline = monotonicTime();
+}
+
+// run one tick in the real time mode. rule 2 drops a fidelity level
+// when the smoothed cost goes over TICKBUDGET of the period and goes
+// back up once it has stayed under TICKRECOVER for recoverWait ticks.
+// a tick that finishes after its deadline is a miss, the next tick is
+// then due a period after it finished rather than trying to catch up
+void realTimeTick() {
+
+   // variables
+   double period = 1.0 / tickRate;
+   double start, end;
+   double late;
+   struct timespec wake;
+
+
+   start = monotonicTime();
+   moveBoids();
+   end = monotonicTime();
+
+   ticksRun++;
+   fidelityTicks[fidelity]++;
+   if (tickCost == 0.0)
+      tickCost = end - start;
+   else
+      tickCost += TICKSMOOTH * (end - start - tickCost);
+
+   if (fidelityHold > 0) {
+      fidelityHold--;
+      // going up stayed within budget, reset the wait
+      if (fidelityHold == 0 && movedUp && tickCost <= period * TICKBUDGET) {
+         recoverWait = TICKHOLD;
+         movedUp = 0;
+      }
+   } else if (tickCost > period * TICKBUDGET && fidelity < fidelityLevels - 1) {
+      if (movedUp && recoverWait < TICKHOLD << 6)
+         recoverWait *= 2;
+      movedUp = 0;
+      setFidelity(fidelity + 1);
+      fidelityHold = TICKHOLD;
+      underBudget = 0;
+      tickCost = 0.0;
+   } else if (tickCost < period * TICKRECOVER && fidelity > 0) {
+      if (++underBudget >= recoverWait) {
+         movedUp = 1;
+         setFidelity(fidelity - 1);
+         fidelityHold = TICKHOLD;
+         underBudget = 0;
+         tickCost = 0.0;
+      }
+   } else
+      underBudget = 0;
+
+   // the curses program drew the frame before the tick, so its time
+   // counts against the deadline too
+   nextDeadline += period;
+   end = monotonicTime();
+   late = end - nextDeadline;
+   if (late > 0.0) {
+      deadlinesMissed++;
+      if (late > worstLate)
+         worstLate = late;
+      nextDeadline = end;
+   } else {
+      wake.tv_sec = (time_t)nextDeadline;
+      wake.tv_nsec = (long)((nextDeadline - wake.tv_sec) * 1000000000.0);
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+   }
+}
+
+// print the deadlines missed and the ticks run at each fidelity level
+void reportRealTime() {
+
+   // variables
+   int level;
+
+
+   setFidelity(0);
+   printf("Real time %.1lf ticks per second, deadlines missed %ld of %ld, worst %.3lf ms late\n",
+      tickRate, deadlinesMissed, ticksRun, worstLate * 1000.0);
+   for(level=0; level<fidelityLevels; level++) {
+      if (level == 0 && baseSeparation == SEPARATIONEXACT)
+         printf("\tfidelity %d, rule 2 exact: %ld ticks\n", level, fidelityTicks[level]);
+      else if (level == 0 && baseSeparation == SEPARATIONSWEEP)
+         printf("\tfidelity %d, rule 2 sweep: %ld ticks\n", level, fidelityTicks[level]);
+      else if (level == 0 && baseSeparation == SEPARATIONSAMPLED)
+         printf("\tfidelity %d, rule 2 sampled %.2f: %ld ticks\n", level, sampleRate, fidelityTicks[level]);
+      else
+         printf("\tfidelity %d, rule 2 nearest %d: %ld ticks\n", level,
+            level == 0 ? baseNeighbours : fidelityNeighbours(level), fidelityTicks[level]);
+   }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// -P compares each phase with what the machine can do. at startup a
+// STREAM style triad measures the bandwidth of each cache level and of
+// memory, and independent multiply-add chains the flop rate, both on
+// every thread of the pool. each phase's rate comes from its per-thread
+// timers and the bytes and flops it spends on each boid, and is compared
+// with the bandwidth of the smallest level its working set fits in. the
+// counts are the loads, stores and arithmetic the source asks for
+
+
+// triadRounds triads over triadLength doubles of this thread's share of
+// the calibration arrays
+void triadJob(int id) {
+
+   // variables
+   long i, r;
+   long min = (long)CALIBRATESIZE * id / threadsize;
+   long max = (long)CALIBRATESIZE * (id + 1) / threadsize;
+   double *a, *b;
+   double *c = calibrateArrays[2];
+
+
+   if (max > min + triadLength)
+      max = min + triadLength;
+
+   // each round reads what the last one wrote, so the compiler cannot
+   // skip all but the last round
+   for(r=0; r<triadRounds; r++) {
+      a = calibrateArrays[r & 1];
+      b = calibrateArrays[1 - (r & 1)];
+      for(i=min; i<max; i++)
+         a[i] = b[i] + 3.0 * c[i];
+   }
+}
+
+// CALIBRATEROUNDS multiply-adds on each of CALIBRATELANES floats
+void flopJob(int id) {
+
+   // variables
+   int r, k;
+   float chain[CALIBRATELANES];
+
+
+   for(k=0; k<CALIBRATELANES; k++)
+      chain[k] = k + id;
+   for(r=0; r<CALIBRATEROUNDS; r++)
+      for(k=0; k<CALIBRATELANES; k++)
+         chain[k] = chain[k] * 0.999f + 0.001f;
+
+   // kept on every thread so no thread's loop is thrown away
+   memcpy(calibrateSink[id], chain, sizeof(chain));
+}
+
+// best time of CALIBRATEREPEATS runs of job on the pool
+double timeJob(void (*job)(int)) {
+
+   // variables
+   int r;
+   double best;
+   double seconds;
+   struct timespec start;
+   struct timespec end;
+
+
+   best = -1.0;
+   for(r=0; r<CALIBRATEREPEATS; r++) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      runPool(job);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+      if (best < 0.0 || seconds < best)
+         best = seconds;
+   }
+   return(best);
+}
+
+// measure the peak bandwidth and flop rate of the pool
+void calibratePeaks() {
+
+   // variables
+   int k;
+   long i;
+   long share = CALIBRATESIZE / threadsize;
+
+
+   // L1 and L2 belong to each core, L3 is shared between the threads
+   levelSize[0] = sysconf(_SC_LEVEL1_DCACHE_SIZE) > 0 ? sysconf(_SC_LEVEL1_DCACHE_SIZE) : LEVEL1SIZE;
+   levelSize[1] = sysconf(_SC_LEVEL2_CACHE_SIZE) > 0 ? sysconf(_SC_LEVEL2_CACHE_SIZE) : LEVEL2SIZE;
+   levelSize[2] = (sysconf(_SC_LEVEL3_CACHE_SIZE) > 0 ? sysconf(_SC_LEVEL3_CACHE_SIZE) : LEVEL3SIZE) / threadsize;
+   levelSize[3] = 0;
+
+   for(k=0; k<3; k++) {
+      if (posix_memalign((void**)&calibrateArrays[k], 64, sizeof(double) * CALIBRATESIZE) != 0) {
+         printf("Unable to allocate the calibration arrays\n");
+         exit(1);
+      }
+      for(i=0; i<CALIBRATESIZE; i++)
+         calibrateArrays[k][i] = 1.0;
+   }
+   calibrateSink = malloc(sizeof(*calibrateSink) * threadsize);
+
+   // the triad reads two arrays and writes one. a cache level's arrays
+   // fill half of it, and are gone through enough times to move as many
+   // bytes as the run in memory. a cache as large as the memory run is
+   // measured at a quarter of it
+   for(k=0; k<CALIBRATELEVELS; k++) {
+      triadLength = share;
+      if (levelSize[k] > 0)
+         triadLength = levelSize[k] / 2 / (long)(3 * sizeof(double)) < share / 4 ?
+            levelSize[k] / 2 / (long)(3 * sizeof(double)) : share / 4;
+      triadRounds = share / triadLength;
+      peakBandwidth[k] = 3.0 * sizeof(double) * triadLength * triadRounds * threadsize / timeJob(triadJob);
+   }
+   peakFlops = 2.0 * CALIBRATELANES * CALIBRATEROUNDS * threadsize / timeJob(flopJob);
+
+   for(k=0; k<3; k++)
+      free(calibrateArrays[k]);
+   free(calibrateSink);
+}
+
+// add the boids rule 2 looked at this iteration
+void countPairs() {
+
+   // variables
+   int i;
+   long scanned;
+
+
+   if (separationMode == SEPARATIONEXACT) {
+      rule2Pairs += (double)popsize * (popsize - 1);
+      return;
+   }
+   scanned = 0;
+   for(i=0; i<threadsize; i++)
+      scanned += gridParts[i].scanned;
+   rule2Pairs += scanned - lastScanned;
+   lastScanned = scanned;
+}
+
+// print each phase's time, rates and share of the peaks. rates are per
+// second of thread time so phases that only run on some threads of the
+// hybrid engine compare fairly, one thread's peak being the measured
+// peak over the number of threads
+void reportPhases() {
+
+   // variables
+   int i, p, l;
+   double seconds;
+   double bytes, flops;
+   double working;
+   double threadFlops = peakFlops / threadsize;
+
+
+   printf("Peak bandwidth");
+   for(l=0; l<CALIBRATELEVELS; l++)
+      printf(" %s %.2lf GB/s,", levelNames[l], peakBandwidth[l] / 1e9);
+   printf(" peak %.2lf GFLOP/s on %d threads\n", peakFlops / 1e9, threadsize);
+   for(p=0; p<PHASES; p++) {
+      seconds = 0.0;
+      for(i=0; i<threadsize; i++)
+         seconds += phaseTimes[i].seconds[p];
+
+      if (p == PHASERULE2) {
+         bytes = rule2Pairs * RULE2BYTES;
+         flops = rule2Pairs * RULE2FLOPS;
+      } else {
+         bytes = (double)phaseBytes[p] * popsize * (p == PHASESUMS ? sumsTicks : profileTicks);
+         flops = (double)phaseFlops[p] * popsize * (p == PHASESUMS ? sumsTicks : profileTicks);
+         // the hybrid engine also adds rule 2's update to boidUpdate
+         if (p == PHASEUPDATE && engine == ENGINEHYBRID && threadsize > 1) {
+            bytes += 36.0 * popsize * profileTicks;
+            flops += 3.0 * popsize * profileTicks;
+         }
+      }
+
+      // the smallest level one thread's working set fits in
+      working = (double)phaseFootprint[p] * popsize / (p == PHASERULE2 ? 1 : threadsize);
+      for(l=0; l<CALIBRATELEVELS-1 && working > levelSize[l]; l++)
+         ;
+
+      if (seconds <= 0.0 || bytes == 0.0)
+         printf("\tphase %s: %lf thread seconds\n", phaseNames[p], seconds);
+      else
+         printf("\tphase %s: %lf thread seconds, %.2lf GB/s %.1lf%% of %s peak, %.2lf GFLOP/s %.1lf%% of peak, %.2lf flops per byte\n",
+            phaseNames[p], seconds,
+            bytes / seconds / 1e9, 100.0 * bytes / seconds / (peakBandwidth[l] / threadsize),
+            levelNames[l],
+            flops / seconds / 1e9, 100.0 * flops / seconds / threadFlops,
+            flops / bytes);
+   }
+   if (gridSeconds > 0.0)
+      printf("\tsorting and binning for rule 2: %lf seconds\n", gridSeconds);
+}
+
+
+// name of a page mode for the report at the end
+char *pageName(int mode) {
+   if (mode == PAGESHUGETLB)
+      return("2 MB pages (MAP_HUGETLB)");
+   else if (mode == PAGESTHP)
+      return("transparent huge pages (MADV_HUGEPAGE)");
+   return("normal pages");
+}
+
+#ifdef __linux__
+// madvise() accepts MADV_HUGEPAGE even when transparent huge pages are
+// turned off, so check the setting the kernel will actually use
+int thpEnabled() {
+
+   // variables
+   FILE *fp;
+   char line[128];
+   int enabled;
+
+
+   fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+   if (fp == NULL)
+      return(0);
+   enabled = fgets(line, sizeof(line), fp) != NULL && strstr(line, "[never]") == NULL;
+   fclose(fp);
+   return(enabled);
+}
+#endif
+
+// allocate size bytes of boid storage, backed by huge pages when mode
+// allows it. the kind of pages obtained is stored in got
+void *allocatePages(size_t size, int mode, int *got) {
+
+   // variables
+   void *memory;
+   size_t rounded;
+
+
+   *got = PAGESNORMAL;
+
+#ifdef __linux__
+   // huge pages only help arrays that span several of them, auto leaves
+   // small arrays on normal pages rather than rounding them up to 2 MB
+   rounded = (size + HUGEPAGESIZE - 1) / HUGEPAGESIZE * HUGEPAGESIZE;
+   if (mode == PAGESAUTO && size < HUGEPAGESIZE)
+      mode = PAGESNORMAL;
+
+   // pages reserved in /proc/sys/vm/nr_hugepages, fails when the pool
+   // is empty or too small
+   if (mode == PAGESHUGETLB || mode == PAGESAUTO) {
+      memory = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (memory != MAP_FAILED) {
+         *got = PAGESHUGETLB;
+         return(memory);
+      }
+   }
+
+   // ask the kernel to back the range with huge pages when it can find
+   // them, fails when transparent huge pages are disabled. only -H thp
+   // gives up when the 2 MB aligned range cannot be had, the other modes
+   // drop through to normal pages
+   if (mode == PAGESHUGETLB || mode == PAGESTHP || mode == PAGESAUTO) {
+      if (posix_memalign(&memory, HUGEPAGESIZE, rounded) == 0) {
+         if (madvise(memory, rounded, MADV_HUGEPAGE) == 0 && thpEnabled())
+            *got = PAGESTHP;
+         return(memory);
+      }
+      if (mode == PAGESTHP)
+         return(NULL);
+   }
+#else
+   (void)rounded;
+#endif
+
+   // cache line aligned so a split that starts on a multiple of
+   // ALIGNBOIDS also starts on a cache line
+   if (posix_memalign(&memory, 64, size) != 0)
+      return(NULL);
+   return(memory);
+}
+
+// allocate arrays
+void allocateArrays() {
+   
+   // variables
+   int i;
+
+   // one block for all boids so a split that starts on a multiple
+   // of ALIGNBOIDS also starts on a cache line
+   boidStorage = allocatePages(sizeof(float) * 6 * popsize, pageMode, &boidPages);
+   updateStorage = allocatePages(sizeof(float) * 3 * popsize, pageMode, &updatePages);
+   if (boidStorage == NULL || updateStorage == NULL) {
+      printf("Unable to allocate %d boids\n", popsize);
+      exit(1);
+   }
+
+   boidArray = malloc(sizeof(float *) * popsize);
+   for(i=0; i<popsize; i++)
+      boidArray[i] = &boidStorage[i * 6];
+
+   boidUpdate = malloc(sizeof(float *) * popsize);
+   for(i=0; i<popsize; i++)
+      boidUpdate[i] = &updateStorage[i * 3];
+
+   // only the hybrid engine needs a separate rule 2 update
+   if (engine == ENGINEHYBRID || autoEngine) {
+      if (posix_memalign((void**)&separationStorage, 64, sizeof(float) * 3 * popsize) != 0) {
+         printf("Unable to allocate %d boids\n", popsize);
+         exit(1);
+      }
+      separationUpdate = malloc(sizeof(float *) * popsize);
+      for(i=0; i<popsize; i++)
+         separationUpdate[i] = &separationStorage[i * 3];
+   }
+
+   // the real time mode can drop to knn from any -s mode
+   if (separationMode == SEPARATIONKNN || tickRate > 0.0)
+      allocateGrid();
+   if (separationMode == SEPARATIONSWEEP || separationMode == SEPARATIONSAMPLED)
+      allocateSweep();
+
+}
+
+// round a split position to the nearest multiple of ALIGNBOIDS, or the
+// nearest boid when there are too few boids to give every thread a
+// whole multiple
+int alignSplit(double position) {
+
+   // variables
+   int aligned;
+
+   if (popsize < ALIGNBOIDS * threadsize)
+      aligned = (int)(position + 0.5);
+   else
+      aligned = (int)(position / ALIGNBOIDS + 0.5) * ALIGNBOIDS;
+   if (aligned > popsize)
+      aligned = popsize;
+
+   return(aligned);
+}
+
+// allocate threads
+void allocateThreads() {
+
+   // assign
+   threadArray = malloc(sizeof(pthread_t) * threadsize);
+
+   // malloc for the splits
+   splitArray = malloc(sizeof(int*) * (threadsize));
+   for(int i = 0; i < threadsize; i++)
+      splitArray[i] = malloc(sizeof(int) * 3);
+
+   splitCost = malloc(sizeof(double) * threadsize);
+   partialSums = malloc(sizeof(struct partialSum) * threadsize);
+   gridParts = calloc(threadsize, sizeof(struct gridPart));
+   sampleParts = calloc(threadsize, sizeof(struct samplePart));
+   metricParts = calloc(threadsize, sizeof(struct metricPart));
+   phaseTimes = calloc(threadsize, sizeof(struct phaseTime));
+   sumsReady = 0;
+   
+
+   // calculate the number of splits based on 
+   tasksize = (double)popsize / (double)threadsize;
+
+   // start with the same number of boids in each split, the splits are
+   // moved later by rebalanceThreads() with -b once rule 2 has been timed
+   for(int i = 0; i < threadsize; i++) {
+      splitArray[i][0] = alignSplit(tasksize * i);
+      splitArray[i][1] = alignSplit(tasksize * (i + 1));
+      splitArray[i][2] = i;
+      splitCost[i] = 0.0;
+   }
+
+   // the last split always ends with the last boid
+   splitArray[threadsize - 1][1] = popsize;
+   rebalanceCount = 0;
+
+   // snapshots for the bounded staleness engine
+   if (engine == ENGINEASYNC)
+      allocateAsync();
+
+   // the hybrid engine starts with one thread on the O(N) work, rule 2
+   // is nearly always the larger part
+   groupsize = 1;
+   initBarrier(&groupBarrier, groupsize);
+
+   // start the pool, thread 0 is the main thread
+   initBarrier(&phaseBarrier, threadsize);
+   for(int i = 1; i < threadsize; i++)
+      pthread_create(&threadArray[i], NULL, poolWorker, (void*)(long)i);
+}
+
+// move the splits so the measured rule 2 time is the same for each thread
+void rebalanceThreads() {
+
+   // variables
+   int i;
+   int cur;
+   double total;
+   double target;
+   double below;
+   double boidCost;
+   int *ends;
+
+
+   total = 0.0;
+   for(i = 0; i < threadsize; i++)
+      total += splitCost[i];
+
+   // nothing measured yet, or a single thread
+   if (total <= 0.0 || threadsize == 1) {
+      rebalanceCount = 0;
+      return;
+   }
+
+   // treat the cost as spread evenly over the boids of each split and walk
+   // along the boids until each thread's share of the total is reached.
+   // the splits are then rounded to ALIGNBOIDS
+   ends = malloc(sizeof(int) * threadsize);
+   cur = 0;
+   below = 0.0;
+   for(i = 0; i < threadsize - 1; i++) {
+      target = total * (i + 1) / threadsize;
+
+      while(cur < threadsize - 1 && below + splitCost[cur] < target) {
+         below += splitCost[cur];
+         cur++;
+      }
+
+      // position inside split cur where the target is reached, an empty
+      // split has no boids to spread its cost over
+      if (splitArray[cur][1] > splitArray[cur][0] && splitCost[cur] > 0.0) {
+         boidCost = splitCost[cur] / (splitArray[cur][1] - splitArray[cur][0]);
+         ends[i] = alignSplit(splitArray[cur][0] + (target - below) / boidCost);
+      } else {
+         ends[i] = alignSplit(splitArray[cur][0]);
+      }
+
+      if (i > 0 && ends[i] < ends[i - 1])
+         ends[i] = ends[i - 1];
+   }
+   ends[threadsize - 1] = popsize;
+
+   for(i = 0; i < threadsize; i++) {
+      splitArray[i][0] = i == 0 ? 0 : ends[i - 1];
+      splitArray[i][1] = ends[i];
+      splitCost[i] = 0.0;
+   }
+
+   free(ends);
+   rebalanceCount = 0;
+}
+
+// free threads
+void freeThreads() {
+
+   // stop the pool
+   runPool(NULL);
+   for(int i = 1; i < threadsize; i++)
+      pthread_join(threadArray[i], NULL);
+   freeBarrier(&phaseBarrier);
+   freeBarrier(&groupBarrier);
+
+   for(int i = 0; i < threadsize; i++)
+      free(splitArray[i]);
+   free(splitArray);
+   free(splitCost);
+   free(partialSums);
+   free(gridParts);
+   free(sampleParts);
+   free(metricParts);
+   free(phaseTimes);
+   if (engine == ENGINEASYNC) {
+      free(asyncPositions);
+      free(asyncSums);
+      free(asyncBlocks);
+      free(asyncStats);
+   }
+   free(threadArray);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// read a cgroup cpu limit, returns 0 when the file is missing or unlimited
+int cgroupCpus() {
+
+   // variables
+   FILE *fp;
+   char quota[32];
+   long quotaUs;
+   long periodUs;
+
+
+   // cgroup v2, "max 100000" or "<quota> <period>"
+   fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+   if (fp != NULL) {
+      if (fscanf(fp, "%31s %ld", quota, &periodUs) != 2)
+         strcpy(quota, "max");
+      fclose(fp);
+      if (strcmp(quota, "max") == 0 || periodUs <= 0)
+         return(0);
+      quotaUs = atol(quota);
+      return((int)((quotaUs + periodUs - 1) / periodUs));
+   }
+
+   // cgroup v1, quota of -1 means unlimited
+   fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+   if (fp == NULL)
+      return(0);
+   if (fscanf(fp, "%ld", &quotaUs) != 1)
+      quotaUs = -1;
+   fclose(fp);
+
+   fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+   if (fp == NULL)
+      return(0);
+   if (fscanf(fp, "%ld", &periodUs) != 1)
+      periodUs = 0;
+   fclose(fp);
+
+   if (quotaUs <= 0 || periodUs <= 0)
+      return(0);
+   return((int)((quotaUs + periodUs - 1) / periodUs));
+}
+
+// number of cpus this process may actually run on
+int availableCpus() {
+
+   // variables
+   int cpus;
+   int quota;
+
+
+   cpus = THREADS;
+
+#ifdef __linux__
+   // cpus in the affinity mask, this respects taskset and cpusets
+   cpu_set_t mask;
+   if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+      cpus = CPU_COUNT(&mask);
+#endif
+
+   // a cpu quota limits how much of those cpus we can use
+   quota = cgroupCpus();
+   if (quota > 0 && quota < cpus)
+      cpus = quota;
+
+   if (cpus < 1)
+      cpus = 1;
+
+   return(cpus);
+}
+
+// time per iteration using the current threads, the simulation is not
+// restored so the caller has to save and restore the boids
+double timeIterations() {
+
+   // variables
+   int i;
+   double elapsed;
+   double best;
+   struct timespec tickStart;
+   struct timespec tickEnd;
+
+
+   // use the fastest iteration so one slow iteration from another
+   // process does not decide the result
+   best = 0.0;
+   elapsed = 0.0;
+   for(i = 0; i < CALIBRATE && elapsed < CALIBRATETIME; i++) {
+      clock_gettime(CLOCK_MONOTONIC, &tickStart);
+      moveBoids();
+      clock_gettime(CLOCK_MONOTONIC, &tickEnd);
+
+      tickEnd.tv_sec -= tickStart.tv_sec;
+      tickEnd.tv_nsec -= tickStart.tv_nsec;
+      if (i == 0 || tickEnd.tv_sec + tickEnd.tv_nsec / 1000000000.0 < best)
+         best = tickEnd.tv_sec + tickEnd.tv_nsec / 1000000000.0;
+      elapsed += tickEnd.tv_sec + tickEnd.tv_nsec / 1000000000.0;
+   }
+
+   return(best);
+}
+
+// try thread counts up to maxThreads, and both engines with -e auto,
+// and keep the fastest
+void tuneThreads() {
+
+   // variables
+   int i;
+   int candidate;
+   int lastCandidate;
+   int tryEngine;
+   int bestThreads;
+   int bestEngine;
+   int savedCount;
+   int savedSign;
+   FILE *savedMetrics;
+   double tick;
+   double bestTick;
+   float *saved;
+   struct timespec tuneStart;
+   struct timespec tuneEnd;
+
+
+   clock_gettime(CLOCK_MONOTONIC, &tuneStart);
+
+   // the calibration iterations move the boids so save them first
+   saved = malloc(sizeof(float) * 6 * popsize);
+   for(i = 0; i < popsize; i++)
+      memcpy(&saved[i * 6], boidArray[i], sizeof(float) * 6);
+   savedCount = flockCount;
+   savedSign = flockSign;
+
+   // the calibration iterations are not part of the metrics stream
+   savedMetrics = metricsFile;
+   metricsFile = NULL;
+
+   // try 1, 2, 3, 4, 6, 9, ... threads and then maxThreads itself
+   bestThreads = threadsize;
+   bestEngine = engine;
+   bestTick = -1.0;
+   candidate = autoThreads ? 1 : threadsize;
+   lastCandidate = autoThreads ? maxThreads : threadsize;
+   while(1) {
+      if (candidate > lastCandidate)
+         candidate = lastCandidate;
+
+      freeThreads();
+      threadsize = candidate;
+      allocateThreads();
+
+      for(tryEngine = ENGINEDATA; tryEngine <= ENGINEHYBRID; tryEngine++) {
+
+         // the hybrid engine needs two threads
+         if (!autoEngine && tryEngine != bestEngine)
+            continue;
+         if (autoEngine && tryEngine == ENGINEHYBRID && candidate < 2)
+            continue;
+
+         engine = tryEngine;
+         tick = timeIterations();
+         if (bestTick < 0.0 || tick < bestTick) {
+            bestTick = tick;
+            bestThreads = candidate;
+            bestEngine = tryEngine;
+         }
+
+         for(i = 0; i < popsize; i++)
+            memcpy(boidArray[i], &saved[i * 6], sizeof(float) * 6);
+         sumsReady = 0;
+         flockCount = savedCount;
+         flockSign = savedSign;
+      }
+
+      if (candidate == lastCandidate)
+         break;
+      candidate = candidate * 3 / 2 > candidate + 1 ? candidate * 3 / 2 : candidate + 1;
+   }
+
+   freeThreads();
+   threadsize = bestThreads;
+   engine = bestEngine;
+   allocateThreads();
+
+   free(saved);
+   metricsFile = savedMetrics;
+
+   clock_gettime(CLOCK_MONOTONIC, &tuneEnd);
+   tuneTime += (tuneEnd.tv_sec - tuneStart.tv_sec);
+   tuneTime += (tuneEnd.tv_nsec - tuneStart.tv_nsec) / 1000000000.0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifdef MICROBENCH
+
+// the microbench build, -DMICROBENCH. timing a whole run mixes every
+// rule, the barriers and the threads together, this main runs each of
+// the kernels above on its own, on one thread, over flocks from a few
+// boids that fit in the L1 cache up to ones that only fit in main
+// memory. each kernel is warmed up, run enough times in a row for a
+// sample to be long enough to time, and sampled repeatedly. samples
+// further than OUTLIERMADS median absolute deviations from the median
+// are dropped (an interrupt or another process) and the rest averaged.
+// the O(N) kernels report ns per boid and the O(N*N) ones ns per pair
+
+// largest flock timed by default, about 100 MB of boids
+#define MAXPOP (1 << 21)
+
+// smallest flock, each flock after it is POPSTEP times larger
+#define MINPOP 64
+#define POPSTEP 8
+
+// samples kept for each kernel and flock, and runs thrown away first
+#define REPEATS 21
+#define WARMUP 3
+
+// a sample runs the kernel until it takes at least this many seconds
+#define SAMPLETIME 0.0002
+
+// pairs of boids in one run of the O(N*N) kernels, rows of the flock
+// against every boid so large flocks are not timed for minutes
+#define PAIRS (1 << 20)
+
+// samples further than this many median absolute deviations from the
+// median are dropped. MADSCALE turns the deviation into a standard
+// deviation for normally distributed samples
+#define OUTLIERMADS 3.0
+#define MADSCALE 1.4826
+
+// boids of the flock the O(N*N) kernels run for each run
+int rows;
+
+// sums of the positions and velocities for rule 1 and rule 3
+float benchSums[6];
+
+// result of distanceKernel() the compiler must not throw away
+volatile float benchSink;
+
+// samples for each kernel, runs thrown away first and largest flock
+int repeats;
+int warmup;
+int maxpop;
+
+// distance() between the first rows boids and every boid
+void distanceKernel() {
+
+   // variables
+   int i, j;
+   float total;
+
+   total = 0.0;
+   for(i=0; i<rows; i++)
+      for(j=0; j<popsize; j++)
+         total += distance(i, j);
+   benchSink = total;
+}
+
+// rule 2's exact loop for the first rows boids
+void rule2Kernel() {
+   rule2(0, 0, rows, boidUpdate, 1);
+}
+
+// the rule 1 and rule 3 reduction
+void sumsKernel() {
+   sumBoids(0, 0, popsize);
+   flockSums(benchSums, 1);
+}
+
+void rule1Kernel() {
+   rule1(0, popsize, benchSums);
+}
+
+void rule3Kernel() {
+   rule3(0, popsize, benchSums);
+}
+
+// moves the boids and sums them for the next iteration
+void updateKernel() {
+   updateBoids(0, 0, popsize);
+}
+
+// the kernels, what each one is timed per and how many of those one run does
+struct kernel {
+   char *name;
+   void (*run)();
+   int pairs;
+};
+
+struct kernel kernels[] = {
+   { "distance", distanceKernel, 1 },
+   { "rule2", rule2Kernel, 1 },
+   { "sums", sumsKernel, 0 },
+   { "rule1", rule1Kernel, 0 },
+   { "rule3", rule3Kernel, 0 },
+   { "update", updateKernel, 0 },
+};
+
+#define KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+// seconds for calls runs of a kernel
+double timeRuns(void (*run)(), long calls) {
+
+   // variables
+   long c;
+   double start;
+
+   start = monotonicTime();
+   for(c=0; c<calls; c++)
+      run();
+   return(monotonicTime() - start);
+}
+
+int compareDoubles(const void *a, const void *b) {
+   return((*(double*)a > *(double*)b) - (*(double*)a < *(double*)b));
+}
+
+// time kernel k on the current flock and print one line
+void benchKernel(int k) {
+
+   // variables
+   int i;
+   int kept;
+   long calls;
+   double units;
+   double *samples;
+   double *deviation;
+   double median, mad;
+   double mean, best;
+   struct kernel *kernel = &kernels[k];
+
+
+   // the same boids for every kernel, the default start of a run
+   srandom(1);
+   splitArray[0][1] = popsize;
+   initBoids();
+   sumsKernel();
+
+   // runs in a sample, doubled until a sample is long enough to time
+   calls = 1;
+   while(timeRuns(kernel->run, calls) < SAMPLETIME)
+      calls *= 2;
+   for(i=0; i<warmup; i++)
+      timeRuns(kernel->run, calls);
+
+   // ns per boid or pair of each sample
+   units = (double)calls * (kernel->pairs ? (double)rows * popsize : popsize);
+   samples = malloc(sizeof(double) * repeats);
+   deviation = malloc(sizeof(double) * repeats);
+   for(i=0; i<repeats; i++)
+      samples[i] = timeRuns(kernel->run, calls) / units * 1e9;
+
+   // drop the samples far from the median
+   qsort(samples, repeats, sizeof(double), compareDoubles);
+   median = samples[repeats / 2];
+   for(i=0; i<repeats; i++)
+      deviation[i] = fabs(samples[i] - median);
+   qsort(deviation, repeats, sizeof(double), compareDoubles);
+   mad = deviation[repeats / 2];
+
+   kept = 0;
+   mean = 0.0;
+   best = samples[0];
+   for(i=0; i<repeats; i++) {
+      if (fabs(samples[i] - median) > OUTLIERMADS * MADSCALE * mad && mad > 0.0)
+         continue;
+      mean += samples[i];
+      kept++;
+   }
+   mean /= kept;
+
+   printf("%-9s %9d %9.1lf %10.3lf %10.3lf %6d/%-3d ns per %s\n",
+      kernel->name, popsize,
+      (sizeof(float) * 9 + sizeof(float *) * 2) * (double)popsize / 1024.0,
+      mean, best, kept, repeats, kernel->pairs ? "pair" : "boid");
+
+   free(samples);
+   free(deviation);
+}
+
+// print usage
+void printUsage(char *name) {
+   printf("USAGE: %s <-m max_pop> <-r repeats> <-w warmup> <-k kernel>\n", name);
+   printf("\n");
+   printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+   printf("\n");
+   printf("   max_pop -the largest flock, flocks run from %d boids up in\n", MINPOP);
+   printf("   steps of %d times (default %d)\n", POPSTEP, MAXPOP);
+   printf("\n");
+   printf("   repeats -samples of each kernel and flock (default %d)\n", REPEATS);
+   printf("\n");
+   printf("   warmup -samples thrown away before timing (default %d)\n", WARMUP);
+   printf("\n");
+   printf("   kernel -only time this kernel, distance, rule2, sums, rule1,\n");
+   printf("   rule3 or update (default all)\n");
+   printf("\n");
+   printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n\n");
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// main function of the microbench build
+int main(int argc, char *argv[]) {
+
+   // variables
+   int k;
+   int argPtr;
+   char *only;
+
+
+   // assign intial values
+   maxpop = MAXPOP;
+   repeats = REPEATS;
+   warmup = WARMUP;
+   only = NULL;
+
+   // one thread running the default data engine and exact rule 2,
+   // without -M so updateBoids() does not add up the metrics
+   threadsize = 1;
+   engine = ENGINEDATA;
+   autoEngine = 0;
+   pageMode = PAGESNORMAL;
+   precision = PRECISIONFLOAT;
+   separationMode = SEPARATIONEXACT;
+   tickRate = 0.0;
+   metricsFile = NULL;
+   metricsTick = 0;
+   initShape = INITUNIFORM;
+   initDensity = 0.0;
+
+
+   // read command line arguments
+   argPtr = 1;
+   while(argPtr < argc) {
+      if (strcmp(argv[argPtr], "-m") == 0 && argPtr+1 < argc) {
+         sscanf(argv[argPtr+1], "%d", &maxpop);
+         argPtr += 2;
+      } else if (strcmp(argv[argPtr], "-r") == 0 && argPtr+1 < argc) {
+         sscanf(argv[argPtr+1], "%d", &repeats);
+         argPtr += 2;
+      } else if (strcmp(argv[argPtr], "-w") == 0 && argPtr+1 < argc) {
+         sscanf(argv[argPtr+1], "%d", &warmup);
+         argPtr += 2;
+      } else if (strcmp(argv[argPtr], "-k") == 0 && argPtr+1 < argc) {
+         only = argv[argPtr+1];
+         argPtr += 2;
+      } else {
+         printUsage(argv[0]);
+         exit(1);
+      }
+   }
+
+   for(k=0; k<KERNELS; k++)
+      if (only == NULL || strcmp(only, kernels[k].name) == 0)
+         break;
+   if (maxpop < MINPOP || repeats < 1 || warmup < 0 || k == KERNELS) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+
+   // arrays for the largest flock, smaller flocks use the start
+   popsize = maxpop;
+   allocateArrays();
+   allocateThreads();
+
+   printf("%-9s %9s %9s %10s %10s %10s\n", "kernel", "boids", "KB", "mean ns", "min ns", "kept");
+   for(k=0; k<KERNELS; k++) {
+      if (only != NULL && strcmp(only, kernels[k].name) != 0)
+         continue;
+      for(popsize=MINPOP; popsize<=maxpop; popsize*=POPSTEP) {
+         rows = PAIRS / popsize;
+         if (rows > popsize)
+            rows = popsize;
+         if (rows < 1)
+            rows = 1;
+         benchKernel(k);
+      }
+   }
+
+   freeThreads();
+}
+
+#else
+
+// print usage
+void printUsage(char *name) {
+
+   printf("USAGE: %s <-i iterations> <-c pop_size> <-t threads|auto> <-e engine> <-S staleness> <-r retune> <-b rebalance> <-w wait> <-H pages> <-p precision> <-v view> <-o prefix> <-n every> <-x pixels> <-s separation> <-k neighbours> <-f fraction> <-R rate> <-M file> <-m every> <-P> <-d shape> <-D density>\n", name);
+   printf("\n");
+   printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+   printf("\n");
+   printf("   iterations -the number of times the population will be updated\n");
+   printf("\n");
+   printf("   pop_size -the number of boids to create\n");
+   printf("   the number of iterations only affects the non-curses program boidspt\n");
+   printf("   the curses program exits when q is pressed\n");
+   printf("\n");
+   printf("   threads -the number of threads to use for the application\n");
+   printf("   make sure that you a valid number of threads. \n");
+   printf("   auto times a few iterations with different numbers of threads\n");
+   printf("   and uses the fastest, limited by the cpu affinity and cgroup quota\n");
+   printf("\n");
+   printf("   engine -data splits every rule between the threads (default),\n");
+   printf("   hybrid runs rule 1, rule 3 and moveFlock on some threads at the\n");
+   printf("   same time as rule 2 on the rest, sizing the groups from their\n");
+   printf("   measured cost every rebalance iterations. auto tries both.\n");
+   printf("   async removes the barriers, each thread runs its own iterations\n");
+   printf("   and reads the other threads' boids from older snapshots\n");
+   printf("\n");
+   printf("   staleness -with -e async, how many iterations old a snapshot may\n");
+   printf("   be before a thread waits for it (default %d). 0 gives the same\n", STALENESS);
+   printf("   result as the data engine\n");
+   printf("\n");
+   printf("   retune -with -t auto or -e auto, the number of iterations between tuning\n");
+   printf("   again as the flock changes shape, 0 only tunes at startup\n");
+   printf("\n");
+   printf("   rebalance -the number of iterations between moving the boundaries\n");
+   printf("   between threads so each spends the same time in rule 2, 0 keeps\n");
+   printf("   the same number of boids in each thread (default). in the hybrid\n");
+   printf("   engine this moves threads between the two groups instead, every\n");
+   printf("   %d iterations by default. the splits follow measured times and\n", GROUPREBALANCE);
+   printf("   the flock sums are added in the order of the splits, so runs that\n");
+   printf("   rebalance are not repeatable\n");
+   printf("\n");
+   printf("   wait -how threads wait at the barriers between phases, the\n");
+   printf("   number of times to check the barrier before sleeping (default %d),\n", WAITSPINS);
+   printf("   spin to never sleep or sleep to sleep straight away. spin is best\n");
+   printf("   when every thread has a core to itself\n");
+   printf("\n");
+   printf("   pages -what backs the boid arrays, hugetlb for 2 MB pages from the\n");
+   printf("   reserved pool, thp for transparent huge pages, off for normal\n");
+   printf("   pages. auto (default) tries hugetlb then thp for arrays of 2 MB\n");
+   printf("   or more\n");
+   printf("\n");
+   printf("   precision -how boids are stored, float (default), half for 16 bit\n");
+   printf("   floats or int16 for fixed point. the compact modes store each\n");
+   printf("   value in 2 bytes but keep the float arrays for the reference\n");
+   printf("   run and widen the positions for rule 2, so they use more memory\n");
+   printf("   than float. they report how far the flock drifts from a float\n");
+   printf("   run and only run in the data engine\n");
+   printf("\n");
+   printf("   view -the curses program draws an o for every boid with dots\n");
+   printf("   (default), or with density shows how many boids are in each\n");
+   printf("   screen cell, \"%s\" from one boid to 64 or more\n", DENSITYGLYPHS);
+   printf("\n");
+   printf("   prefix -the timing program saves a picture of the flock as\n");
+   printf("   prefix00000.ppm, prefix00001.ppm, ... every few iterations\n");
+   printf("\n");
+   printf("   every -the number of iterations between pictures (default %d)\n", FRAMEEVERY);
+   printf("\n");
+   printf("   pixels -the width and height of each picture (default %d)\n", FRAMESIZE);
+   printf("\n");
+   printf("   separation -how rule 2 finds the boids to move away from. exact\n");
+   printf("   (default) checks every boid, knn only uses the nearest neighbours\n");
+   printf("   within 5.0, found through a grid. sweep keeps the boids sorted\n");
+   printf("   along the axis they are spread furthest on and only checks the\n");
+   printf("   boids within 5.0 along it. sampled only looks at a random\n");
+   printf("   fraction of those and reports the error against exact on a\n");
+   printf("   few boids. not with -e async or -p\n");
+   printf("\n");
+   printf("   neighbours -with -s knn, how many neighbours (default %d, at\n", NEIGHBOURS);
+   printf("   most %d)\n", MAXNEIGHBOURS);
+   printf("\n");
+   printf("   fraction -with -s sampled, the fraction of the boids within 5.0\n");
+   printf("   along the sweep axis to look at (default %.2f)\n", SAMPLERATE);
+   printf("\n");
+   printf("   file -write a line of flock metrics every few iterations:\n");
+   printf("   cohesion radius, polarization of the velocities, distance to\n");
+   printf("   the nearest boid and boids rule 2 moved away from, per boid.\n");
+   printf("   not with -e async or -p\n");
+   printf("\n");
+   printf("   every -the number of iterations between lines (default %d)\n", METRICSEVERY);
+   printf("\n");
+   printf("   -P -measure the memory bandwidth and flop rate at startup and\n");
+   printf("   report how close each phase of an iteration gets to them.\n");
+   printf("   not with -e async, -p or auto tuning\n");
+   printf("\n");
+   printf("   shape -how the boids start, uniform (default) in a cube,\n");
+   printf("   cluster in one tight ball, clusters in %d balls around the\n", INITCLUSTERCOUNT);
+   printf("   screen, sheet in a flat square or line along one axis\n");
+   printf("\n");
+   printf("   density -how many other boids are within 5.0 of a boid on\n");
+   printf("   average at the start, sets the size of the shape\n");
+   printf("\n");
+   printf("   rate -run at this many ticks per second instead of as fast as\n");
+   printf("   possible. when a tick takes too long rule 2 drops to fewer\n");
+   printf("   neighbours and goes back up when there is time again, missed\n");
+   printf("   deadlines are reported at the end. not with -e async or -p\n");
+   printf("\n");
+   printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n\n");
+}
+
+// main function
+int main(int argc, char *argv[]) {
+   
+   // variables
+   int i;
+   int count;
+   int argPtr;
+   int rebalanceSet;
+
+
+   // assign intial values
+   // set the default population size
+   popsize = POPSIZE;
+   
+   // set number of iterations, only used for timing tests in boidspt
+   // not used in curses version
+   count = ITERATIONS;
+
+   // set the number of threads to use
+   threadsize = THREADS;
+   autoThreads = 0;
+   engine = ENGINEDATA;
+   autoEngine = 0;
+   staleness = STALENESS;
+   retune = RETUNE;
+   rebalance = REBALANCE;
+   rebalanceSet = 0;
+   pageMode = PAGESAUTO;
+   precision = PRECISIONFLOAT;
+   separationMode = SEPARATIONEXACT;
+   neighbours = NEIGHBOURS;
+   tickRate = 0.0;
+   sampleRate = SAMPLERATE;
+   metricsFile = NULL;
+   metricsName = NULL;
+   metricsEvery = METRICSEVERY;
+   metricsTick = 0;
+   profile = 0;
+   initShape = INITUNIFORM;
+   initDensity = 0.0;
+#ifndef NOGRAPHICS
+   viewMode = VIEWDOTS;
+#else
+   framePrefix = NULL;
+   frameEvery = FRAMEEVERY;
+   frameSize = FRAMESIZE;
+#endif
+   waitSpins = WAITSPINS;
+   tuneTime = 0.0;
+
+   // flockSign flips on the first iteration, so the flock starts moving
+   // towards (60,60,60) as in boids.c
+   flockCount = 0;
+   flockSign = 1;
+
+
+   // read command line arguments for number of iterations and
+   // number of boids
+   if (argc > 1) {
+      argPtr = 1;
+      while(argPtr < argc) {
+         if (strcmp(argv[argPtr], "-i") == 0) {
+            sscanf(argv[argPtr+1], "%d", &count);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-c") == 0) {
+            sscanf(argv[argPtr+1], "%d", &popsize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-t") == 0) {
+            if (strcmp(argv[argPtr+1], "auto") == 0)
+               autoThreads = 1;
+            else
+               sscanf(argv[argPtr+1], "%d", &threadsize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-e") == 0) {
+            if (strcmp(argv[argPtr+1], "hybrid") == 0)
+               engine = ENGINEHYBRID;
+            else if (strcmp(argv[argPtr+1], "async") == 0)
+               engine = ENGINEASYNC;
+            else if (strcmp(argv[argPtr+1], "auto") == 0)
+               autoEngine = 1;
+            else if (strcmp(argv[argPtr+1], "data") != 0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-S") == 0) {
+            sscanf(argv[argPtr+1], "%d", &staleness);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-r") == 0) {
+            sscanf(argv[argPtr+1], "%d", &retune);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-b") == 0) {
+            sscanf(argv[argPtr+1], "%d", &rebalance);
+            rebalanceSet = 1;
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-w") == 0) {
+            if (strcmp(argv[argPtr+1], "spin") == 0)
+               waitSpins = -1;
+            else if (strcmp(argv[argPtr+1], "sleep") == 0)
+               waitSpins = 0;
+            else
+               sscanf(argv[argPtr+1], "%d", &waitSpins);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-s") == 0) {
+            if (strcmp(argv[argPtr+1], "knn") == 0)
+               separationMode = SEPARATIONKNN;
+            else if (strcmp(argv[argPtr+1], "sweep") == 0)
+               separationMode = SEPARATIONSWEEP;
+            else if (strcmp(argv[argPtr+1], "sampled") == 0)
+               separationMode = SEPARATIONSAMPLED;
+            else if (strcmp(argv[argPtr+1], "exact") != 0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-k") == 0) {
+            sscanf(argv[argPtr+1], "%d", &neighbours);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-f") == 0) {
+            sscanf(argv[argPtr+1], "%lf", &sampleRate);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-d") == 0) {
+            if (strcmp(argv[argPtr+1], "cluster") == 0)
+               initShape = INITCLUSTER;
+            else if (strcmp(argv[argPtr+1], "clusters") == 0)
+               initShape = INITCLUSTERS;
+            else if (strcmp(argv[argPtr+1], "sheet") == 0)
+               initShape = INITSHEET;
+            else if (strcmp(argv[argPtr+1], "line") == 0)
+               initShape = INITLINE;
+            else if (strcmp(argv[argPtr+1], "uniform") != 0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-D") == 0) {
+            sscanf(argv[argPtr+1], "%lf", &initDensity);
+            if (initDensity <= 0.0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-P") == 0) {
+            profile = 1;
+            argPtr += 1;
+         } else if (strcmp(argv[argPtr], "-M") == 0) {
+            metricsName = argv[argPtr+1];
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-m") == 0) {
+            sscanf(argv[argPtr+1], "%d", &metricsEvery);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-R") == 0) {
+            sscanf(argv[argPtr+1], "%lf", &tickRate);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-p") == 0) {
+#ifdef __FLT16_MAX__
+            if (strcmp(argv[argPtr+1], "half") == 0)
+               precision = PRECISIONHALF;
+            else
+#endif
+            if (strcmp(argv[argPtr+1], "int16") == 0)
+               precision = PRECISIONFIXED;
+            else if (strcmp(argv[argPtr+1], "float") != 0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+#ifndef NOGRAPHICS
+         } else if (strcmp(argv[argPtr], "-v") == 0) {
+            if (strcmp(argv[argPtr+1], "density") == 0)
+               viewMode = VIEWDENSITY;
+            else if (strcmp(argv[argPtr+1], "dots") != 0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+#else
+         } else if (strcmp(argv[argPtr], "-o") == 0) {
+            framePrefix = argv[argPtr+1];
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-n") == 0) {
+            sscanf(argv[argPtr+1], "%d", &frameEvery);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-x") == 0) {
+            sscanf(argv[argPtr+1], "%d", &frameSize);
+            argPtr += 2;
+#endif
+         } else if (strcmp(argv[argPtr], "-H") == 0) {
+            if (strcmp(argv[argPtr+1], "hugetlb") == 0)
+               pageMode = PAGESHUGETLB;
+            else if (strcmp(argv[argPtr+1], "thp") == 0)
+               pageMode = PAGESTHP;
+            else if (strcmp(argv[argPtr+1], "off") == 0)
+               pageMode = PAGESNORMAL;
+            else if (strcmp(argv[argPtr+1], "auto") != 0) {
+               printUsage(argv[0]);
+               exit(1);
+            }
+            argPtr += 2;
+         } else {
+            printUsage(argv[0]);
+            exit(1);
+         }
+      }
+   }
+
+
+   // the bounded staleness engine keeps its splits and thread count fixed
+   if (engine == ENGINEASYNC) {
+      if (autoThreads || autoEngine || rebalanceSet || staleness < 0) {
+         printUsage(argv[0]);
+         exit(1);
+      }
+      rebalance = 0;
+   }
+
+   // the hybrid engine sizes its groups unless -b says otherwise
+   groupRebalance = rebalanceSet ? rebalance : GROUPREBALANCE;
+
+#ifdef NOGRAPHICS
+   // frames are drawn from boidArray, which the compact modes do not move
+   if (frameEvery < 1 || frameSize < 1
+    || (framePrefix != NULL && precision != PRECISIONFLOAT)) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+   if (framePrefix == NULL && count > 0)
+      frameEvery = count;
+#endif
+
+   // the other rule 2 modes are only written for the data and hybrid
+   // engines, and the real time mode falls back on knn
+   if (neighbours < 1 || neighbours > MAXNEIGHBOURS || tickRate < 0.0
+    || sampleRate <= 0.0 || sampleRate > 1.0
+    || ((separationMode != SEPARATIONEXACT || tickRate > 0.0)
+      && (engine == ENGINEASYNC || precision != PRECISIONFLOAT))) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+
+   // the metrics come out of the float kernels of the data and hybrid
+   // engines
+   if (metricsEvery < 1
+    || (metricsName != NULL && (engine == ENGINEASYNC || precision != PRECISIONFLOAT))) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+   if (metricsName != NULL) {
+      metricsFile = fopen(metricsName, "w");
+      if (metricsFile == NULL) {
+         printf("Unable to write %s\n", metricsName);
+         exit(1);
+      }
+      fprintf(metricsFile, "# iteration cohesion polarization nearest contacts\n");
+   }
+
+   // the phase timers are in the data and hybrid engines' float kernels,
+   // and would be lost each time tuning restarts the pool
+   if (profile && (engine == ENGINEASYNC || precision != PRECISIONFLOAT
+    || autoThreads || autoEngine)) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+
+   // the compact kernels are written for the data engine's phases, and
+   // tuning would only save and restore boidArray
+   if (precision != PRECISIONFLOAT && (engine != ENGINEDATA || autoEngine || autoThreads)) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+
+   // allocate space for theads and set up slitting
+   allocateThreads();
+
+   // allocate space for arrays to store boid position and velocity
+   allocateArrays();
+
+   // measure the machine before anything else uses it
+   if (profile)
+      calibratePeaks();
 
 
    // intialize graphics 
@@ -561,6 +4364,15 @@ int main(int argc, char *argv[]) {
    timeout(0);
    curs_set(FALSE);
 
+   // one colour for each density level, from cold to hot
+   if (viewMode == VIEWDENSITY && has_colors()) {
+      short ramp[DENSITYLEVELS] = { COLOR_BLACK, COLOR_BLUE, COLOR_CYAN, COLOR_GREEN,
+         COLOR_YELLOW, COLOR_MAGENTA, COLOR_RED, COLOR_WHITE };
+      start_color();
+      for(i=1; i<DENSITYLEVELS; i++)
+         init_pair(i, ramp[i], COLOR_BLACK);
+   }
+
    // Global var `stdscr` is created by the call to `initscr()`
    getmaxyx(stdscr, max_y, max_x);
 
@@ -570,12 +4382,33 @@ int main(int argc, char *argv[]) {
    // place boids in initial positions
    initBoids();
 
+   // pick the number of threads from the boids' starting positions
+   if (autoThreads) {
+      maxThreads = availableCpus();
+      if (maxThreads > popsize)
+         maxThreads = popsize;
+   }
+   if (autoThreads || autoEngine)
+      tuneThreads();
+
+   // boidArray keeps the starting positions for the float reference
+   if (precision != PRECISIONFLOAT)
+      allocateCompact();
+
+   if (tickRate > 0.0)
+      startRealTime();
+
    // draw and move boids using ncurses
    // do not calculate timing in this loop, ncurses will reduce performance
 #ifndef NOGRAPHICS
-   while(1) {
+   for(i=0; 1; i++) {
       if (drawBoids() == 1) break; // run until the user hits q
-      moveBoids();
+      if ((autoThreads || autoEngine) && retune > 0 && i > 0 && i % retune == 0)
+         tuneThreads();
+      if (tickRate > 0.0)
+         realTimeTick();
+      else
+         moveBoids();
    }
 #endif
 
@@ -586,20 +4419,42 @@ int main(int argc, char *argv[]) {
    printf("Number of boids per thread %lf\n", tasksize);
    printf("Thread Data Ranges:\n");
    for(int i = 0; i < threadsize; i++)
-      printf("\tthread 1: [%d][%d]\n", 
+      printf("\tthread %d: [%d][%d] %d boids\n", 
+         i,
          splitArray[i][0], 
          splitArray[i][1],
-         splitArray[i][0] - splitArray[i][1]);
+         splitArray[i][1] - splitArray[i][0]);
    
    printf("Number of iterations %d\n", count);
    printf("Number of boids %d\n", popsize);
+   printf("Boid storage on %s, update storage on %s\n",
+      pageName(boidPages), pageName(updatePages));
 
 
+   if (framePrefix != NULL)
+      startFrames();
+
    /*** Start timing here ***/
    clock_gettime(CLOCK_MONOTONIC, &startTime);
    
+   // the bounded staleness engine runs all iterations without stopping,
+   // or up to each frame
+   if (engine == ENGINEASYNC) {
+      for(i=0; i<count; i+=frameEvery) {
+         runAsync(count - i < frameEvery ? count - i : frameEvery);
+         if (framePrefix != NULL)
+            drawFrame();
+      }
+   } else
    for(i=0; i<count; i++) {
-      moveBoids();
+      if ((autoThreads || autoEngine) && retune > 0 && i > 0 && i % retune == 0)
+         tuneThreads();
+      if (tickRate > 0.0)
+         realTimeTick();
+      else
+         moveBoids();
+      if (framePrefix != NULL && (i + 1) % frameEvery == 0)
+         drawFrame();
    }
    
    /*** End timing here ***/
@@ -609,7 +4464,95 @@ int main(int argc, char *argv[]) {
    elapsedTime = (endTime.tv_sec - startTime.tv_sec);
    elapsedTime += (endTime.tv_nsec - startTime.tv_nsec) / 1000000000.0;
    
+   if (framePrefix != NULL) {
+      stopFrames();
+      printf("Frames written %d, drawing %lf waiting for the writer %lf\n",
+         frameNumber + 1, frameTime, frameWait);
+   }
    printf("Time elapsed %lf\n", elapsedTime);
+   if (initShape != INITUNIFORM || initDensity > 0.0)
+      printf("Started as %s of size %.2lf\n",
+         initNames[initShape], initSize);
+
+   // run the same iterations in float from the starting positions still
+   // in boidArray, outside the timing
+   if (precision != PRECISIONFLOAT) {
+      int compact = precision;
+      printf("Boid state %d bytes per boid, %s\n", (int)(6 * sizeof(short)),
+         compact == PRECISIONHALF ? "half floats" : "int16 fixed point");
+      precision = PRECISIONFLOAT;
+      flockCount = 0;
+      flockSign = 1;
+      sumsReady = 0;
+      for(i=0; i<count; i++)
+         moveBoids();
+      precision = compact;
+      reportDrift();
+   }
+   if (rebalance > 0) {
+      printf("Final Thread Data Ranges:\n");
+      for(int i = 0; i < threadsize; i++)
+         printf("\tthread %d: [%d][%d] %d boids\n",
+            i,
+            splitArray[i][0],
+            splitArray[i][1],
+            splitArray[i][1] - splitArray[i][0]);
+   }
+   if (engine == ENGINEHYBRID && threadsize > 1)
+      printf("Hybrid engine, %d threads on rule 1, rule 3 and moveFlock, %d on rule 2\n",
+         groupsize, threadsize - groupsize);
+   else if (engine == ENGINEASYNC) {
+      printf("Bounded staleness engine, staleness %d\n", staleness);
+      for(int i = 0; i < threadsize; i++)
+         printf("\tblock %d: mean staleness %.3lf max %d waiting %lf\n",
+            i,
+            asyncStats[i].stalenessReads > 0 ?
+               (double)asyncStats[i].stalenessSum / asyncStats[i].stalenessReads : 0.0,
+            asyncStats[i].stalenessMax,
+            asyncStats[i].waitTime);
+   } else
+      printf("Data parallel engine\n");
+   if (tickRate > 0.0)
+      reportRealTime();
+   if (profile)
+      reportPhases();
+   if (separationMode == SEPARATIONKNN && count > 0 && popsize > 0) {
+      long scanned = 0, used = 0;
+      for(int i = 0; i < threadsize; i++) {
+         scanned += gridParts[i].scanned;
+         used += gridParts[i].used;
+      }
+      printf("Rule 2 nearest %d, boids looked at %.1lf used %.2lf per boid, cell size %.3f\n",
+         neighbours, (double)scanned / popsize / count, (double)used / popsize / count, cellSize);
+   }
+   if (separationMode == SEPARATIONSWEEP && count > 0 && popsize > 0) {
+      long scanned = 0;
+      for(int i = 0; i < threadsize; i++)
+         scanned += gridParts[i].scanned;
+      printf("Rule 2 sweep along %c, boids looked at %.1lf per boid\n",
+         "xyz"[sweepAxis], (double)scanned / popsize / count);
+   }
+   if (separationMode == SEPARATIONSAMPLED && count > 0 && popsize > 0) {
+      long scanned = 0, checked = 0;
+      double errorSum = 0.0, exactSum = 0.0;
+      for(int i = 0; i < threadsize; i++) {
+         scanned += gridParts[i].scanned;
+         errorSum += sampleParts[i].errorSum;
+         exactSum += sampleParts[i].exactSum;
+         checked += sampleParts[i].checked;
+      }
+      printf("Rule 2 sampled %.2f along %c, boids looked at %.1lf per boid\n",
+         sampleRate, "xyz"[sweepAxis], (double)scanned / popsize / count);
+      if (checked > 0)
+         printf("Rule 2 error on %ld checked boids, rms %.4lf, relative to exact %.4lf\n",
+            checked, sqrt(errorSum / checked), exactSum > 0.0 ? sqrt(errorSum / exactSum) : 0.0);
+      else
+         printf("Rule 2 error, no boids checked, every window was run in full\n");
+   }
+   if (autoThreads)
+      printf("Threads used %d of %d available\n", threadsize, maxThreads);
+   if (autoThreads || autoEngine)
+      printf("Time spent tuning %lf\n", tuneTime);
 
 #endif
 
@@ -617,6 +4560,15 @@ int main(int argc, char *argv[]) {
 
    // shut down ncurses
    endwin();
+   if (tickRate > 0.0)
+      reportRealTime();
+   if (profile)
+      reportPhases();
 #endif
 
+   if (metricsFile != NULL)
+      fclose(metricsFile);
+
 }
+
+#endif
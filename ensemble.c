@@ -0,0 +1,1197 @@
+/* Boids ensemble, many independent flocks in one process
+   -Boids algorithms from "Boids Pseudocode:
+   http://www.kfish.org/boids/pseudocode.html
+
+   each flock is simulated exactly as in boids.c but with its own seed,
+   arrays and moveFlock() state. small flocks do not benefit from
+   splitting a single flock across threads (see data.c) so instead the
+   threads work on different flocks. all flocks share one pool of worker
+   threads which take the next unfinished flock until none are left.
+
+   with -b the flocks are also packed into batches of LANES flocks which
+   are stored interleaved, boid i of every flock in the batch sits next
+   to each other in memory. the batch kernels then step all the flocks of
+   a batch through the same loops at once, one flock per SIMD lane, which
+   keeps the vector units full even when each flock is tiny.
+
+   with -g the numbers boids.c hardcodes become parameters. every
+   combination of the values given is run -m times, all runs share the
+   one pool, and the flock metrics of each combination are averaged over
+   its runs into a single results table (-o).
+*/
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// include
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<string.h>
+#include<pthread.h>
+#include<time.h>
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// default population size of each flock, number of boids
+#define POPSIZE 50
+
+// maximum screen size, both height and width
+#define SCREENSIZE 100
+
+// default number of iterations to run each flock for
+#define ITERATIONS 1000
+
+// default number of threads in the worker pool
+#define THREADS 4
+
+// default number of flocks in the ensemble
+#define FLOCKS 16
+
+// default seed of the first flock, flock k uses SEED + k
+#define SEED 1
+
+// default parameters, the values boids.c hardcodes. rule 2 moves away
+// from boids closer than SEPARATION, rule 3 moves 1/ALIGNMENT of the way
+// to the average velocity and moveFlock() pulls 1/PULL of the way to
+// (TARGET1,TARGET1,TARGET1) or (TARGET2,TARGET2,TARGET2), switching
+// every SWITCHEVERY iterations
+#define SEPARATION 5.0
+#define ALIGNMENT 8.0
+#define PULL 200.0
+#define SWITCHEVERY 200
+#define TARGET1 40.0
+#define TARGET2 60.0
+
+// parameters -g can sweep, and the most values it takes for each
+#define PARAMSIZE 6
+#define MAXVALUES 64
+
+// number of flocks interleaved in a batch, one per SIMD lane
+// build with -DLANES=16 for 512 bit vectors
+#ifndef LANES
+#define LANES 8
+#endif
+
+// boid location (x,y,z) and velocity (vx,vy,vz) in boidArray[][]
+#define BX 0
+#define BY 1
+#define BZ 2
+#define VX 3
+#define VY 4
+#define VZ 5
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// rule constants of a flock. alignment and pull stay double so the
+// updates are worked out in double as they are in boids.c
+struct params {
+   float separation;
+   double alignment;
+   double pull;
+   int switchEvery;
+   float target[2];
+
+   // squared form of rule 2's test for the batch kernels, see
+   // separationSquare()
+   float separation2;
+};
+
+// one independent flock
+struct flock {
+
+   // parameter combination the flock runs and its constants
+   int combo;
+   struct params params;
+
+   // number of boids in this flock
+   int popsize;
+
+   // seed used to place the boids, also used as the random state
+   unsigned int seed;
+
+   // location and velocity of boids
+   float **boidArray;
+
+   // change in velocity is stored for each boid (x,y,z)
+   float **boidUpdate;
+
+   // moveFlock() state, kept per flock instead of static
+   int count;
+   int sign;
+
+   // time spent simulating this flock
+   double elapsedTime;
+
+   // metrics of the flock at the end of the run, see flockMetrics()
+   double cohesion;
+   double polarization;
+   double nearest;
+};
+
+// LANES flocks stored lane-wise, boid i of lane l is at [i*LANES + l]
+struct batch {
+
+   // largest population size in the batch, every lane runs this many boids
+   int popsize;
+
+   // flock in each lane and its population size
+   int flockIndex[LANES];
+   float lanePopsize[LANES];
+
+   // location and velocity of boids, one array per component
+   float *bx, *by, *bz;
+   float *vx, *vy, *vz;
+
+   // change in velocity for each boid
+   float *ux, *uy, *uz;
+
+   // 1 when boid i exists in the flock of lane l, 0 for padding
+   float *active;
+
+   // parameters of each lane
+   float separation2[LANES];
+   double alignment[LANES];
+   double pull[LANES];
+   int switchEvery[LANES];
+   float target[2][LANES];
+
+   // moveFlock() state, every lane has run the same number of iterations
+   // but may switch targets at different times
+   int count;
+   int sign[LANES];
+};
+
+// values -g gives each parameter, a parameter with no values keeps its
+// default. each combination is run replicas times
+char *paramNames[PARAMSIZE] = { "separation", "alignment", "pull", "switch", "target1", "target2" };
+double paramValues[PARAMSIZE][MAXVALUES];
+int valuesize[PARAMSIZE];
+int combosize;
+int replicas;
+// file the combined results are written to, NULL for stdout
+char *resultName;
+
+// number of flocks in the ensemble
+int flocksize;
+// the flocks
+struct flock *flockArray;
+// order the flocks are handed out in, largest first
+int *flockOrder;
+
+// smallest and largest population size of a flock
+int popmin;
+int popmax;
+// number of iterations each flock is run for
+int count;
+// seed of the first flock
+unsigned int seed;
+// run the flocks in lane-wise batches
+int batchMode;
+// number of full batches, any remaining flocks are run on their own
+int batchsize;
+
+// the number of threads in the pool
+int threadsize;
+// the threads to be used
+pthread_t *threadArray;
+// next unit of work to be simulated, batches first then single flocks
+int nextFlock;
+// protects nextFlock
+pthread_mutex_t flockMutex;
+
+// timing
+struct timespec startTime;
+struct timespec endTime;
+double elapsedTime;
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// rule 2's distance < separation test on squared distances, the
+// smallest float whose square root is not below separation, so
+// d*d < separation2 gives the same answer as sqrtf(d*d) < separation
+// for every float without needing the square root. 0x1.8ffffep+4 for 5.0
+float separationSquare(float separation) {
+
+   // variables
+   float square = separation * separation;
+
+   while(square > 0.0f && sqrtf(nextafterf(square, 0.0f)) >= separation)
+      square = nextafterf(square, 0.0f);
+   while(sqrtf(square) < separation)
+      square = nextafterf(square, INFINITY);
+
+   return(square);
+}
+
+// set parameter field of p to value, returns 0 when the value is not
+// allowed
+int setParam(struct params *p, int field, double value) {
+
+   if (field == 0 && value > 0.0)
+      p->separation = value;
+   else if (field == 1 && value != 0.0)
+      p->alignment = value;
+   else if (field == 2 && value != 0.0)
+      p->pull = value;
+   else if (field == 3 && value >= 1.0)
+      p->switchEvery = (int)value;
+   else if (field == 4 || field == 5)
+      p->target[field - 4] = value;
+   else
+      return(0);
+   p->separation2 = separationSquare(p->separation);
+   return(1);
+}
+
+// parameters of combination combo, the first parameter given to -g
+// changes slowest
+void comboParams(int combo, struct params *p) {
+
+   // variables
+   int k;
+
+   p->separation = SEPARATION;
+   p->alignment = ALIGNMENT;
+   p->pull = PULL;
+   p->switchEvery = SWITCHEVERY;
+   p->target[0] = TARGET1;
+   p->target[1] = TARGET2;
+   p->separation2 = separationSquare(p->separation);
+
+   for(k=PARAMSIZE-1; k>=0; k--) {
+      if (valuesize[k] == 0)
+         continue;
+      setParam(p, k, paramValues[k][combo % valuesize[k]]);
+      combo /= valuesize[k];
+   }
+}
+
+// read -g name=value,value,... into paramValues, returns 0 when it
+// does not name a parameter or a value is not allowed
+int readParam(char *arg) {
+
+   // variables
+   int k;
+   char *value, *end;
+   size_t length;
+   struct params check;
+
+   value = strchr(arg, '=');
+   if (value == NULL)
+      return(0);
+   length = value - arg;
+   for(k=0; k<PARAMSIZE; k++)
+      if (strlen(paramNames[k]) == length && strncmp(arg, paramNames[k], length) == 0)
+         break;
+   if (k == PARAMSIZE || valuesize[k] > 0)
+      return(0);
+
+   // each value is checked on top of the defaults
+   comboParams(0, &check);
+
+   do {
+      value++;
+      if (valuesize[k] == MAXVALUES)
+         return(0);
+      paramValues[k][valuesize[k]] = strtod(value, &end);
+      if (end == value || setParam(&check, k, paramValues[k][valuesize[k]]) == 0)
+         return(0);
+      valuesize[k]++;
+      value = end;
+   } while(*value == ',');
+
+   return(*value == '\0');
+}
+
+// intial boids
+void initBoids(struct flock *f) {
+
+   // variables
+   int i;
+
+   // calculate initial random locations for each boid, scaled based on the screen size
+   for(i=0; i<f->popsize; i++) {
+      f->boidArray[i][BX] = (float) (rand_r(&f->seed) % SCREENSIZE);
+      f->boidArray[i][BY] = (float) (rand_r(&f->seed) % SCREENSIZE);
+      f->boidArray[i][BZ] = (float) (rand_r(&f->seed) % SCREENSIZE);
+      f->boidArray[i][VX] = 0.0;
+      f->boidArray[i][VY] = 0.0;
+      f->boidArray[i][VZ] = 0.0;
+   }
+}
+
+// rule 1
+void rule1(struct flock *f) {
+
+   // variables
+   int i;
+   float cx, cy, cz;
+   float **boidArray = f->boidArray;
+   float **boidUpdate = f->boidUpdate;
+
+   cx = 0.0; cy = 0.0; cz = 0.0;
+
+   // calculate centre of mass
+   // calculated once and used for all updates in rule 1
+   for(i=0; i<f->popsize; i++) {
+      cx += boidArray[i][BX];
+      cy += boidArray[i][BY];
+      cz += boidArray[i][BZ];
+   }
+   cx /= f->popsize;
+   cy /= f->popsize;
+   cz /= f->popsize;
+
+   // update velocity, move towards centre of mass
+   // initial use of boidUpdate[][] so overwrite old values
+   for(i=0; i<f->popsize; i++) {
+      boidUpdate[i][BX] = (cx - boidArray[i][BX])/f->popsize;
+      boidUpdate[i][BY] = (cy - boidArray[i][BY])/f->popsize;
+      boidUpdate[i][BZ] = (cz - boidArray[i][BZ])/f->popsize;
+   }
+}
+
+// distance
+float distance(struct flock *f, int i, int j) {
+
+   // variables
+   float **boidArray = f->boidArray;
+
+   // calculate distance by squaring planar distances
+   return(sqrtf(
+      powf(boidArray[i][BX] - boidArray[j][BX],2.0) +
+      powf(boidArray[i][BY] - boidArray[j][BY],2.0) +
+      powf(boidArray[i][BZ] - boidArray[j][BZ],2.0) ));
+}
+
+// rule 2
+void rule2(struct flock *f) {
+
+   // variables
+   int i, j;
+   float cx, cy, cz;
+   float **boidArray = f->boidArray;
+   float **boidUpdate = f->boidUpdate;
+
+   // keep boids from overlapping
+   for(i=0; i<f->popsize; i++) {
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(j=0; j<f->popsize; j++) {
+         if (i != j) {		// calculate when not the same boid
+            if (distance(f,i,j) < f->params.separation) {
+               cx = cx - (boidArray[j][BX] - boidArray[i][BX]);
+               cy = cy - (boidArray[j][BY] - boidArray[i][BY]);
+               cz = cz - (boidArray[j][BZ] - boidArray[i][BZ]);
+            }
+         }
+      }
+      boidUpdate[i][BX] += cx;
+      boidUpdate[i][BY] += cy;
+      boidUpdate[i][BZ] += cz;
+   }
+}
+
+// rule 3
+void rule3(struct flock *f) {
+
+   // variables
+   int i;
+   float cx, cy, cz;
+   float **boidArray = f->boidArray;
+   float **boidUpdate = f->boidUpdate;
+
+   cx = 0.0; cy = 0.0; cz = 0.0;
+
+   // calculate average velocity
+   // calculate once and use for all updates in rule 3
+   for(i=0; i<f->popsize; i++) {
+      cx += boidArray[i][VX];
+      cy += boidArray[i][VY];
+      cz += boidArray[i][VZ];
+   }
+   cx /= f->popsize;
+   cy /= f->popsize;
+   cz /= f->popsize;
+
+   // update velocity, move towards centre of mass
+   for(i=0; i<f->popsize; i++) {
+      boidUpdate[i][BX] += (cx - boidArray[i][VX])/f->params.alignment;
+      boidUpdate[i][BY] += (cy - boidArray[i][VY])/f->params.alignment;
+      boidUpdate[i][BZ] += (cz - boidArray[i][VZ])/f->params.alignment;
+   }
+}
+
+// move the flock towards a point
+void moveFlock(struct flock *f) {
+
+   // variables
+   int i;
+   float px, py, pz;
+   float **boidArray = f->boidArray;
+   float **boidUpdate = f->boidUpdate;
+
+   // pull flock towards two points as the program runs
+   // every switchEvery iterations change point that flock is pulled towards
+   if (f->count % f->params.switchEvery == 0) {
+      f->sign = f->sign * -1;
+   }
+   if (f->sign == 1) {
+   // move flock towards position (40,40,40) by default
+      px = f->params.target[0];
+      py = f->params.target[0];
+      pz = f->params.target[0];
+   } else {
+   // move flock towards position (60,60,60) by default
+      px = f->params.target[1];
+      py = f->params.target[1];
+      pz = f->params.target[1];
+   }
+   // add offset (px,py,pz) to each boid in order to pull it
+   // towards the current target point
+   for(i=0; i<f->popsize; i++) {
+      boidUpdate[i][BX] += (px - boidArray[i][BX])/f->params.pull;
+      boidUpdate[i][BY] += (py - boidArray[i][BY])/f->params.pull;
+      boidUpdate[i][BZ] += (pz - boidArray[i][BZ])/f->params.pull;
+   }
+   f->count++;
+}
+
+// move boids
+void moveBoids(struct flock *f) {
+
+   // variables
+   int i;
+   float **boidArray = f->boidArray;
+   float **boidUpdate = f->boidUpdate;
+
+   rule1(f);
+   rule2(f);
+   rule3(f);
+   moveFlock(f);
+
+   // move boids by calculating updated velocity and new position
+   for (i=0; i<f->popsize; i++) {
+
+      // update velocity for each boid
+      boidArray[i][VX] += boidUpdate[i][BX];
+      boidArray[i][VY] += boidUpdate[i][BY];
+      boidArray[i][VZ] += boidUpdate[i][BZ];
+
+      // update position for each boid
+      boidArray[i][BX] += boidArray[i][VX];
+      boidArray[i][BY] += boidArray[i][VY];
+      boidArray[i][BZ] += boidArray[i][VZ];
+   }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// the batch functions below perform the same operations as the ones above
+// but the innermost loop runs across the LANES flocks of a batch. every
+// lane follows the same control flow so the compiler can vectorize them.
+// padding boids in the smaller flocks of a batch sit at the origin with no
+// velocity, they add nothing to the sums and active[] masks them out of
+// rule 2 and the update.
+
+
+// batch rule 1
+void batchRule1(struct batch *b) {
+
+   // variables
+   int i, l, k;
+   float cx[LANES], cy[LANES], cz[LANES];
+   float * restrict bx = b->bx, * restrict by = b->by, * restrict bz = b->bz;
+   float * restrict ux = b->ux, * restrict uy = b->uy, * restrict uz = b->uz;
+
+   for(l=0; l<LANES; l++) {
+      cx[l] = 0.0; cy[l] = 0.0; cz[l] = 0.0;
+   }
+
+   // calculate centre of mass of each flock
+   for(i=0; i<b->popsize; i++) {
+      for(l=0; l<LANES; l++) {
+         k = i*LANES + l;
+         cx[l] += bx[k];
+         cy[l] += by[k];
+         cz[l] += bz[k];
+      }
+   }
+   for(l=0; l<LANES; l++) {
+      cx[l] /= b->lanePopsize[l];
+      cy[l] /= b->lanePopsize[l];
+      cz[l] /= b->lanePopsize[l];
+   }
+
+   // update velocity, move towards centre of mass
+   for(i=0; i<b->popsize; i++) {
+      for(l=0; l<LANES; l++) {
+         k = i*LANES + l;
+         ux[k] = (cx[l] - bx[k])/b->lanePopsize[l];
+         uy[k] = (cy[l] - by[k])/b->lanePopsize[l];
+         uz[k] = (cz[l] - bz[k])/b->lanePopsize[l];
+      }
+   }
+}
+
+// batch rule 2
+void batchRule2(struct batch *b) {
+
+   // variables
+   int i, j, l;
+   float dx, dy, dz, near;
+   float cx[LANES], cy[LANES], cz[LANES];
+   float mask[LANES];
+   float * restrict separation2 = b->separation2;
+   float * restrict bx = b->bx, * restrict by = b->by, * restrict bz = b->bz;
+   float * restrict ux = b->ux, * restrict uy = b->uy, * restrict uz = b->uz;
+   float * restrict active = b->active;
+
+   // keep boids from overlapping
+   for(i=0; i<b->popsize; i++) {
+      for(l=0; l<LANES; l++) {
+         cx[l] = 0.0; cy[l] = 0.0; cz[l] = 0.0;
+      }
+      for(j=0; j<b->popsize; j++) {
+         if (i == j)
+            continue;
+         // load the mask up front, a load inside the select below stops
+         // the compiler from vectorizing the lane loop
+         for(l=0; l<LANES; l++)
+            mask[l] = active[j*LANES + l];
+         for(l=0; l<LANES; l++) {
+            dx = bx[j*LANES + l] - bx[i*LANES + l];
+            dy = by[j*LANES + l] - by[i*LANES + l];
+            dz = bz[j*LANES + l] - bz[i*LANES + l];
+            near = (dx*dx + dy*dy + dz*dz < separation2[l]) ? mask[l] : 0.0f;
+            cx[l] -= near * dx;
+            cy[l] -= near * dy;
+            cz[l] -= near * dz;
+         }
+      }
+      for(l=0; l<LANES; l++) {
+         ux[i*LANES + l] += cx[l];
+         uy[i*LANES + l] += cy[l];
+         uz[i*LANES + l] += cz[l];
+      }
+   }
+}
+
+// batch rule 3
+void batchRule3(struct batch *b) {
+
+   // variables
+   int i, l, k;
+   float cx[LANES], cy[LANES], cz[LANES];
+   float * restrict vx = b->vx, * restrict vy = b->vy, * restrict vz = b->vz;
+   float * restrict ux = b->ux, * restrict uy = b->uy, * restrict uz = b->uz;
+
+   for(l=0; l<LANES; l++) {
+      cx[l] = 0.0; cy[l] = 0.0; cz[l] = 0.0;
+   }
+
+   // calculate average velocity of each flock
+   for(i=0; i<b->popsize; i++) {
+      for(l=0; l<LANES; l++) {
+         k = i*LANES + l;
+         cx[l] += vx[k];
+         cy[l] += vy[k];
+         cz[l] += vz[k];
+      }
+   }
+   for(l=0; l<LANES; l++) {
+      cx[l] /= b->lanePopsize[l];
+      cy[l] /= b->lanePopsize[l];
+      cz[l] /= b->lanePopsize[l];
+   }
+
+   // update velocity, move towards average velocity
+   for(i=0; i<b->popsize; i++) {
+      for(l=0; l<LANES; l++) {
+         k = i*LANES + l;
+         ux[k] += (cx[l] - vx[k])/b->alignment[l];
+         uy[k] += (cy[l] - vy[k])/b->alignment[l];
+         uz[k] += (cz[l] - vz[k])/b->alignment[l];
+      }
+   }
+}
+
+// batch move flock, each lane pulls towards its own target point
+void batchMoveFlock(struct batch *b) {
+
+   // variables
+   int i, l, k;
+   float p[LANES];
+   float * restrict bx = b->bx, * restrict by = b->by, * restrict bz = b->bz;
+   float * restrict ux = b->ux, * restrict uy = b->uy, * restrict uz = b->uz;
+
+   // every switchEvery iterations change point that flock is pulled towards
+   for(l=0; l<LANES; l++) {
+      if (b->count % b->switchEvery[l] == 0) {
+         b->sign[l] = b->sign[l] * -1;
+      }
+      if (b->sign[l] == 1)
+         p[l] = b->target[0][l];
+      else
+         p[l] = b->target[1][l];
+   }
+
+   for(i=0; i<b->popsize; i++) {
+      for(l=0; l<LANES; l++) {
+         k = i*LANES + l;
+         ux[k] += (p[l] - bx[k])/b->pull[l];
+         uy[k] += (p[l] - by[k])/b->pull[l];
+         uz[k] += (p[l] - bz[k])/b->pull[l];
+      }
+   }
+   b->count++;
+}
+
+// batch move boids
+void batchMoveBoids(struct batch *b) {
+
+   // variables
+   int k;
+   float * restrict bx = b->bx, * restrict by = b->by, * restrict bz = b->bz;
+   float * restrict vx = b->vx, * restrict vy = b->vy, * restrict vz = b->vz;
+   float * restrict ux = b->ux, * restrict uy = b->uy, * restrict uz = b->uz;
+   float * restrict active = b->active;
+
+   batchRule1(b);
+   batchRule2(b);
+   batchRule3(b);
+   batchMoveFlock(b);
+
+   // padding boids are never moved
+   for(k=0; k<b->popsize*LANES; k++) {
+      vx[k] += active[k] * ux[k];
+      vy[k] += active[k] * uy[k];
+      vz[k] += active[k] * uz[k];
+
+      bx[k] += active[k] * vx[k];
+      by[k] += active[k] * vy[k];
+      bz[k] += active[k] * vz[k];
+   }
+}
+
+// aligned float array for a batch
+float *allocateLanes(int popsize) {
+
+   // variables
+   void *lanes;
+
+   if (posix_memalign(&lanes, 64, sizeof(float) * popsize * LANES) != 0) {
+      printf("Unable to allocate batch of %d boids\n", popsize);
+      exit(1);
+   }
+   memset(lanes, 0, sizeof(float) * popsize * LANES);
+
+   return((float*)lanes);
+}
+
+// copy LANES flocks starting at flockOrder[first] into a new batch
+void loadBatch(struct batch *b, int first) {
+
+   // variables
+   int i, l, k;
+   struct flock *f;
+
+   // flockOrder is sorted by size so the first flock is the largest
+   b->popsize = flockArray[flockOrder[first]].popsize;
+   b->count = flockArray[flockOrder[first]].count;
+
+   b->bx = allocateLanes(b->popsize);
+   b->by = allocateLanes(b->popsize);
+   b->bz = allocateLanes(b->popsize);
+   b->vx = allocateLanes(b->popsize);
+   b->vy = allocateLanes(b->popsize);
+   b->vz = allocateLanes(b->popsize);
+   b->ux = allocateLanes(b->popsize);
+   b->uy = allocateLanes(b->popsize);
+   b->uz = allocateLanes(b->popsize);
+   b->active = allocateLanes(b->popsize);
+
+   for(l=0; l<LANES; l++) {
+      b->flockIndex[l] = flockOrder[first + l];
+      f = &flockArray[b->flockIndex[l]];
+      b->lanePopsize[l] = f->popsize;
+      b->sign[l] = f->sign;
+      b->separation2[l] = f->params.separation2;
+      b->alignment[l] = f->params.alignment;
+      b->pull[l] = f->params.pull;
+      b->switchEvery[l] = f->params.switchEvery;
+      b->target[0][l] = f->params.target[0];
+      b->target[1][l] = f->params.target[1];
+
+      for(i=0; i<f->popsize; i++) {
+         k = i*LANES + l;
+         b->bx[k] = f->boidArray[i][BX];
+         b->by[k] = f->boidArray[i][BY];
+         b->bz[k] = f->boidArray[i][BZ];
+         b->vx[k] = f->boidArray[i][VX];
+         b->vy[k] = f->boidArray[i][VY];
+         b->vz[k] = f->boidArray[i][VZ];
+         b->active[k] = 1.0;
+      }
+   }
+}
+
+// copy the batch back into its flocks and release it
+void storeBatch(struct batch *b, double batchTime) {
+
+   // variables
+   int i, l, k;
+   struct flock *f;
+
+   for(l=0; l<LANES; l++) {
+      f = &flockArray[b->flockIndex[l]];
+
+      for(i=0; i<f->popsize; i++) {
+         k = i*LANES + l;
+         f->boidArray[i][BX] = b->bx[k];
+         f->boidArray[i][BY] = b->by[k];
+         f->boidArray[i][BZ] = b->bz[k];
+         f->boidArray[i][VX] = b->vx[k];
+         f->boidArray[i][VY] = b->vy[k];
+         f->boidArray[i][VZ] = b->vz[k];
+      }
+      f->count = b->count;
+      f->sign = b->sign[l];
+      f->elapsedTime = batchTime;
+   }
+
+   free(b->bx); free(b->by); free(b->bz);
+   free(b->vx); free(b->vy); free(b->vz);
+   free(b->ux); free(b->uy); free(b->uz);
+   free(b->active);
+}
+
+// measure a flock at the end of its run. cohesion is the root mean
+// square distance from the centre of mass, polarization is the length
+// of the mean velocity over the mean speed, 1 when every boid flies the
+// same way, and nearest is the mean distance to the closest other boid
+void flockMetrics(struct flock *f) {
+
+   // variables
+   int i, j;
+   double cx, cy, cz;
+   double vx, vy, vz;
+   double dx, dy, dz;
+   double spread, speed, closest, d;
+   float **boidArray = f->boidArray;
+
+   cx = 0.0; cy = 0.0; cz = 0.0;
+   vx = 0.0; vy = 0.0; vz = 0.0;
+   speed = 0.0;
+   for(i=0; i<f->popsize; i++) {
+      cx += boidArray[i][BX];
+      cy += boidArray[i][BY];
+      cz += boidArray[i][BZ];
+      vx += boidArray[i][VX];
+      vy += boidArray[i][VY];
+      vz += boidArray[i][VZ];
+      speed += sqrt((double)boidArray[i][VX] * boidArray[i][VX]
+         + (double)boidArray[i][VY] * boidArray[i][VY]
+         + (double)boidArray[i][VZ] * boidArray[i][VZ]);
+   }
+   cx /= f->popsize;
+   cy /= f->popsize;
+   cz /= f->popsize;
+
+   spread = 0.0;
+   for(i=0; i<f->popsize; i++) {
+      dx = boidArray[i][BX] - cx;
+      dy = boidArray[i][BY] - cy;
+      dz = boidArray[i][BZ] - cz;
+      spread += dx * dx + dy * dy + dz * dz;
+   }
+   f->cohesion = sqrt(spread / f->popsize);
+   f->polarization = speed > 0.0 ? sqrt(vx * vx + vy * vy + vz * vz) / speed : 0.0;
+
+   f->nearest = 0.0;
+   if (f->popsize < 2)
+      return;
+   for(i=0; i<f->popsize; i++) {
+      closest = INFINITY;
+      for(j=0; j<f->popsize; j++) {
+         if (i == j)
+            continue;
+         dx = boidArray[j][BX] - boidArray[i][BX];
+         dy = boidArray[j][BY] - boidArray[i][BY];
+         dz = boidArray[j][BZ] - boidArray[i][BZ];
+         d = dx * dx + dy * dy + dz * dz;
+         if (d < closest)
+            closest = d;
+      }
+      f->nearest += sqrt(closest);
+   }
+   f->nearest /= f->popsize;
+}
+
+// mean and standard deviation of each combination's metrics over its
+// runs, one line per combination
+void writeResults(FILE *out) {
+
+   // variables
+   int c, i, m;
+   int runs;
+   double sum[4], square[4];
+   double value[4];
+   double mean;
+   struct params p;
+   struct flock *f;
+
+   fprintf(out, "# combo separation alignment pull switch target1 target2 runs"
+      " cohesion cohesion_sd polarization polarization_sd nearest nearest_sd time\n");
+   for(c=0; c<combosize; c++) {
+      comboParams(c, &p);
+      runs = 0;
+      for(m=0; m<4; m++) {
+         sum[m] = 0.0;
+         square[m] = 0.0;
+      }
+      for(i=0; i<flocksize; i++) {
+         f = &flockArray[i];
+         if (f->combo != c)
+            continue;
+         value[0] = f->cohesion;
+         value[1] = f->polarization;
+         value[2] = f->nearest;
+         value[3] = f->elapsedTime;
+         for(m=0; m<4; m++) {
+            sum[m] += value[m];
+            square[m] += value[m] * value[m];
+         }
+         runs++;
+      }
+
+      fprintf(out, "%d %g %g %g %d %g %g %d", c, p.separation, p.alignment, p.pull,
+         p.switchEvery, p.target[0], p.target[1], runs);
+      for(m=0; m<3; m++) {
+         mean = sum[m] / runs;
+         fprintf(out, " %.6f %.6f", mean,
+            runs > 1 ? sqrt(fmax(square[m] - runs * mean * mean, 0.0) / (runs - 1)) : 0.0);
+      }
+      fprintf(out, " %.6f\n", sum[3] / runs);
+   }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// worker, simulates whole flocks or batches until there are none left
+void *runFlocks(void *data) {
+
+   // variables
+   int i;
+   int next;
+   double unitTime;
+   struct flock *f;
+   struct batch b;
+   struct timespec flockStart;
+   struct timespec flockEnd;
+
+   // every worker takes from the same pool
+   (void)data;
+
+   while(1) {
+
+      // take the next unit of work from the shared pool, the first
+      // batchsize units are batches and the rest are single flocks
+      pthread_mutex_lock(&flockMutex);
+      next = nextFlock++;
+      pthread_mutex_unlock(&flockMutex);
+
+      if (next >= batchsize + flocksize - batchsize * LANES)
+         break;
+
+      if (next < batchsize) {
+         loadBatch(&b, next * LANES);
+
+         clock_gettime(CLOCK_MONOTONIC, &flockStart);
+         for(i=0; i<count; i++)
+            batchMoveBoids(&b);
+         clock_gettime(CLOCK_MONOTONIC, &flockEnd);
+
+         unitTime = (flockEnd.tv_sec - flockStart.tv_sec);
+         unitTime += (flockEnd.tv_nsec - flockStart.tv_nsec) / 1000000000.0;
+         storeBatch(&b, unitTime);
+         for(i=0; i<LANES; i++)
+            flockMetrics(&flockArray[b.flockIndex[i]]);
+
+      } else {
+         f = &flockArray[flockOrder[batchsize * LANES + next - batchsize]];
+
+         clock_gettime(CLOCK_MONOTONIC, &flockStart);
+         for(i=0; i<count; i++)
+            moveBoids(f);
+         clock_gettime(CLOCK_MONOTONIC, &flockEnd);
+
+         f->elapsedTime = (flockEnd.tv_sec - flockStart.tv_sec);
+         f->elapsedTime += (flockEnd.tv_nsec - flockStart.tv_nsec) / 1000000000.0;
+         flockMetrics(f);
+      }
+   }
+
+   return NULL;
+}
+
+// largest flock first, rule2 cost grows with popsize squared
+int compareFlocks(const void *a, const void *b) {
+   return(flockArray[*(int*)b].popsize - flockArray[*(int*)a].popsize);
+}
+
+// allocate flocks
+void allocateFlocks() {
+
+   // variables
+   int i, j;
+   unsigned int sizeSeed;
+   struct flock *f;
+
+   flockArray = malloc(sizeof(struct flock) * flocksize);
+   flockOrder = malloc(sizeof(int) * flocksize);
+
+   for(i=0; i<flocksize; i++) {
+      f = &flockArray[i];
+
+      // each flock has its own seed so runs are reproducible no matter
+      // which thread picks the flock up. the runs of every combination
+      // use the same seeds so they start from the same flocks
+      f->combo = i / replicas;
+      f->seed = seed + i % replicas;
+      comboParams(f->combo, &f->params);
+
+      // population size is drawn from [popmin, popmax] using the flock seed
+      sizeSeed = f->seed;
+      f->popsize = popmin;
+      if (popmax > popmin)
+         f->popsize += rand_r(&sizeSeed) % (popmax - popmin + 1);
+
+      f->count = 0;
+      f->sign = 1;
+      f->elapsedTime = 0.0;
+
+      f->boidArray = malloc(sizeof(float *) * f->popsize);
+      for(j=0; j<f->popsize; j++)
+         f->boidArray[j] = malloc(sizeof(float) * 6);
+
+      f->boidUpdate = malloc(sizeof(float *) * f->popsize);
+      for(j=0; j<f->popsize; j++)
+         f->boidUpdate[j] = malloc(sizeof(float) * 3);
+
+      flockOrder[i] = i;
+   }
+
+   qsort(flockOrder, flocksize, sizeof(int), compareFlocks);
+
+   // neighbouring flocks in flockOrder have similar sizes so batching
+   // them together wastes few padding boids
+   batchsize = 0;
+   if (batchMode)
+      batchsize = flocksize / LANES;
+}
+
+// allocate threads
+void allocateThreads() {
+
+   threadArray = malloc(sizeof(pthread_t) * threadsize);
+   pthread_mutex_init(&flockMutex, NULL);
+   nextFlock = 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// main function
+int main(int argc, char *argv[]) {
+
+   // variables
+   int i, j;
+   int argPtr;
+   long boidSteps;
+   float cx, cy, cz;
+   struct flock *f;
+   FILE *results;
+
+
+   // assign intial values
+   popmin = POPSIZE;
+   popmax = POPSIZE;
+   count = ITERATIONS;
+   threadsize = THREADS;
+   flocksize = FLOCKS;
+   seed = SEED;
+   batchMode = 0;
+   resultName = NULL;
+   for(i=0; i<PARAMSIZE; i++)
+      valuesize[i] = 0;
+
+
+   // read command line arguments
+   if (argc > 1) {
+      argPtr = 1;
+      while(argPtr < argc) {
+         if (strcmp(argv[argPtr], "-i") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &count);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-c") == 0 && argPtr+1 < argc) {
+            if (sscanf(argv[argPtr+1], "%d:%d", &popmin, &popmax) != 2)
+               popmax = popmin;
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-t") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &threadsize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-m") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &flocksize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-s") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%u", &seed);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-b") == 0) {
+            batchMode = 1;
+            argPtr += 1;
+         } else if (strcmp(argv[argPtr], "-g") == 0 && argPtr+1 < argc) {
+            if (readParam(argv[argPtr+1]) == 0)
+               flocksize = 0;
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-o") == 0 && argPtr+1 < argc) {
+            resultName = argv[argPtr+1];
+            argPtr += 2;
+         } else {
+            argPtr = argc;
+            flocksize = 0;
+         }
+      }
+   }
+
+   if (flocksize < 1 || threadsize < 1 || popmin < 1 || popmax < popmin) {
+      printf("USAGE: %s <-i iterations> <-c pop_size[:pop_max]> <-t threads> <-m flocks> <-s seed> <-b> <-g name=values> <-o results>\n", argv[0]);
+      printf("\n");
+      printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+      printf("\n");
+      printf("   iterations -the number of times each flock will be updated\n");
+      printf("\n");
+      printf("   pop_size -the number of boids in each flock, or the range\n");
+      printf("   pop_size:pop_max that each flock's size is drawn from\n");
+      printf("\n");
+      printf("   threads -the number of threads shared by all flocks\n");
+      printf("\n");
+      printf("   flocks -the number of independent flocks to simulate, with -g\n");
+      printf("   the number of runs of each combination of parameters\n");
+      printf("\n");
+      printf("   seed -the seed of the first flock, flock k uses seed + k\n");
+      printf("\n");
+      printf("   -b -simulate the flocks in batches of %d, one flock per SIMD lane\n", LANES);
+      printf("   flocks left over after the last full batch run on their own\n");
+      printf("\n");
+      printf("   name=values -run every combination of the values given, at most\n");
+      printf("   %d for each parameter, for example -g separation=3,5,7 -g pull=100,200\n", MAXVALUES);
+      printf("   separation -rule 2 distance (default %g)\n", SEPARATION);
+      printf("   alignment -rule 3 moves 1/alignment to the average velocity (default %g)\n", ALIGNMENT);
+      printf("   pull -moveFlock moves 1/pull to the target (default %g)\n", PULL);
+      printf("   switch -iterations between changing target (default %d)\n", SWITCHEVERY);
+      printf("   target1, target2 -the two targets (default %g and %g)\n", TARGET1, TARGET2);
+      printf("\n");
+      printf("   results -file the mean and spread of the cohesion, polarization\n");
+      printf("   and nearest neighbour distance of each combination are written\n");
+      printf("   to, printed when -g is given without it\n");
+      printf("\n");
+      printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n\n");
+      exit(1);
+   }
+
+
+   // every combination runs the -m flocks
+   combosize = 1;
+   for(i=0; i<PARAMSIZE; i++)
+      if (valuesize[i] > 0)
+         combosize *= valuesize[i];
+   replicas = flocksize;
+   flocksize = replicas * combosize;
+
+   // allocate the flocks and the shared pool
+   allocateFlocks();
+   allocateThreads();
+
+   // place boids in initial positions
+   for(i=0; i<flocksize; i++)
+      initBoids(&flockArray[i]);
+
+   printf("Number of flocks %d\n", flocksize);
+   if (combosize > 1)
+      printf("Number of parameter combinations %d, runs of each %d\n", combosize, replicas);
+   printf("Number of threads %d\n", threadsize);
+   printf("Number of iterations %d\n", count);
+   printf("Number of boids per flock %d to %d\n", popmin, popmax);
+   if (batchMode)
+      printf("Number of batches of %d flocks %d\n", LANES, batchsize);
+
+
+   /*** Start timing here ***/
+   clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+   for(i=0; i<threadsize; i++)
+      pthread_create(&threadArray[i], NULL, runFlocks, NULL);
+
+   for(i=0; i<threadsize; i++)
+      pthread_join(threadArray[i], NULL);
+
+   /*** End timing here ***/
+   clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+
+   elapsedTime = (endTime.tv_sec - startTime.tv_sec);
+   elapsedTime += (endTime.tv_nsec - startTime.tv_nsec) / 1000000000.0;
+
+
+   // print the final centre of mass of each flock
+   boidSteps = 0;
+   printf("Flock Results:\n");
+   for(i=0; i<flocksize; i++) {
+      f = &flockArray[i];
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(j=0; j<f->popsize; j++) {
+         cx += f->boidArray[j][BX];
+         cy += f->boidArray[j][BY];
+         cz += f->boidArray[j][BZ];
+      }
+      printf("\tflock %d: seed %u boids %d centre (%.3f, %.3f, %.3f) time %lf\n",
+         i, seed + i % replicas, f->popsize,
+         cx / f->popsize, cy / f->popsize, cz / f->popsize,
+         f->elapsedTime);
+      boidSteps += (long)f->popsize * count;
+   }
+
+   printf("Time elapsed %lf\n", elapsedTime);
+   printf("Boid updates per second %lf\n", boidSteps / elapsedTime);
+
+   // one table for the whole sweep
+   if (resultName != NULL) {
+      results = fopen(resultName, "w");
+      if (results == NULL) {
+         printf("Unable to write %s\n", resultName);
+         exit(1);
+      }
+      writeResults(results);
+      fclose(results);
+      printf("Results of %d parameter combinations written to %s\n", combosize, resultName);
+   } else if (combosize > 1) {
+      printf("Parameter Results:\n");
+      writeResults(stdout);
+   }
+
+}
@@ -0,0 +1,700 @@
+/* Boids split into slabs across several processes
+   -Boids algorithms from "Boids Pseudocode:
+   http://www.kfish.org/boids/pseudocode.html
+
+   space is cut into slabs along x and each process (rank) owns the boids
+   in one slab. every iteration the ranks add up their sums for rule 1
+   and rule 3 (an allreduce), send their neighbours the boids within 5.0
+   of the shared boundary for rule 2 (the halo), move their own boids and
+   then hand boids that left the slab to the neighbour on that side (a
+   migration). a slab is never narrower than 5.0 so the halo only ever
+   comes from the two neighbouring slabs.
+
+   the ranks only talk through a transport that moves bytes between two
+   ranks, so the same code runs over Unix domain sockets or shared memory
+   rings between processes on one machine, and another transport (TCP,
+   MPI) only needs its own send and receive functions.
+*/
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// include
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<string.h>
+#include<time.h>
+#include<float.h>
+#include<sched.h>
+#include<stdatomic.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/wait.h>
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// default population size, number of boids
+#define POPSIZE 2000
+
+// maximum screen size, both height and width
+#define SCREENSIZE 100
+
+// default number of iterations
+#define ITERATIONS 1000
+
+// default number of processes
+#define RANKS 4
+
+// default seed for the initial positions
+#define SEED 1
+
+// rule 2 only looks at boids closer than this, and no slab is narrower
+#define SEPARATION 5.0
+
+// bytes in each shared memory ring, one ring for each direction between
+// each pair of ranks
+#define RINGSIZE (256 * 1024)
+
+// boid location (x,y,z) and velocity (vx,vy,vz)
+#define BX 0
+#define BY 1
+#define BZ 2
+#define VX 3
+#define VY 4
+#define VZ 5
+
+// values in an allreduce, the 6 sums and the number of boids
+#define SUMS 7
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// moves bytes between this rank and another, both calls block until
+// every byte is sent or received
+struct transport {
+   char *name;
+   void (*sendBytes)(int peer, const void *data, size_t size);
+   void (*recvBytes)(int peer, void *data, size_t size);
+};
+
+// one direction between two ranks in shared memory
+struct ring {
+   // bytes written and read so far, the ring holds written - read bytes
+   atomic_size_t written;
+   char pad1[64 - sizeof(atomic_size_t)];
+   atomic_size_t read;
+   char pad2[64 - sizeof(atomic_size_t)];
+   char data[RINGSIZE];
+};
+
+// a growing array of boids
+struct boidList {
+   float (*boid)[6];
+   int count;
+   int capacity;
+};
+
+// variables
+// number of boids in the whole flock and iterations to run
+int popsize;
+int count;
+// this process and the number of processes
+int rank;
+int ranks;
+// transport chosen with -m
+struct transport *transport;
+// socket transport, linkFds[a * ranks + b] is rank a's end of the link to b
+int *linkFds;
+// shared memory transport, rings[a * ranks + b] carries bytes from a to b
+struct ring *rings;
+
+// boids in this rank's slab and the x range of the slab
+struct boidList own;
+float slabLow;
+float slabHigh;
+// positions of the neighbours' boids within 5.0 of the slab
+struct boidList halo;
+// change in velocity of each of this rank's boids
+float (*boidUpdate)[3];
+int updateCapacity;
+// boids leaving the slab on each side, and the buffer for messages
+struct boidList leaving[2];
+struct boidList arriving;
+
+// time spent moving boids and time spent in the transport
+double computeTime;
+double commTime;
+long migrated;
+
+// timing
+struct timespec startTime;
+struct timespec endTime;
+double elapsedTime;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// seconds between two times
+double secondsBetween(struct timespec *start, struct timespec *end) {
+   return((end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+// socket transport
+void socketSend(int peer, const void *data, size_t size) {
+
+   // variables
+   ssize_t sent;
+
+   while(size > 0) {
+      sent = write(linkFds[rank * ranks + peer], data, size);
+      if (sent <= 0) {
+         printf("rank %d: unable to send to rank %d\n", rank, peer);
+         exit(1);
+      }
+      data = (const char *)data + sent;
+      size -= sent;
+   }
+}
+
+void socketRecv(int peer, void *data, size_t size) {
+
+   // variables
+   ssize_t got;
+
+   while(size > 0) {
+      got = read(linkFds[rank * ranks + peer], data, size);
+      if (got <= 0) {
+         printf("rank %d: unable to receive from rank %d\n", rank, peer);
+         exit(1);
+      }
+      data = (char *)data + got;
+      size -= got;
+   }
+}
+
+// shared memory transport, each ring has one writer and one reader so
+// the two counters are all the locking needed
+void ringSend(int peer, const void *data, size_t size) {
+
+   // variables
+   struct ring *r = &rings[rank * ranks + peer];
+   size_t written;
+   size_t space;
+   size_t chunk;
+   size_t at;
+
+   written = atomic_load_explicit(&r->written, memory_order_relaxed);
+   while(size > 0) {
+      space = RINGSIZE - (written - atomic_load_explicit(&r->read, memory_order_acquire));
+      if (space == 0) {
+         sched_yield();
+         continue;
+      }
+      at = written % RINGSIZE;
+      chunk = size < space ? size : space;
+      if (chunk > RINGSIZE - at)
+         chunk = RINGSIZE - at;
+      memcpy(&r->data[at], data, chunk);
+      written += chunk;
+      atomic_store_explicit(&r->written, written, memory_order_release);
+      data = (const char *)data + chunk;
+      size -= chunk;
+   }
+}
+
+void ringRecv(int peer, void *data, size_t size) {
+
+   // variables
+   struct ring *r = &rings[peer * ranks + rank];
+   size_t read;
+   size_t ready;
+   size_t chunk;
+   size_t at;
+
+   read = atomic_load_explicit(&r->read, memory_order_relaxed);
+   while(size > 0) {
+      ready = atomic_load_explicit(&r->written, memory_order_acquire) - read;
+      if (ready == 0) {
+         sched_yield();
+         continue;
+      }
+      at = read % RINGSIZE;
+      chunk = size < ready ? size : ready;
+      if (chunk > RINGSIZE - at)
+         chunk = RINGSIZE - at;
+      memcpy(data, &r->data[at], chunk);
+      read += chunk;
+      atomic_store_explicit(&r->read, read, memory_order_release);
+      data = (char *)data + chunk;
+      size -= chunk;
+   }
+}
+
+struct transport socketTransport = { "unix sockets", socketSend, socketRecv };
+struct transport ringTransport = { "shared memory", ringSend, ringRecv };
+
+// create the links between every pair of ranks before forking
+void openTransport() {
+
+   // variables
+   int a, b;
+   int fds[2];
+
+
+   if (transport == &socketTransport) {
+      linkFds = malloc(sizeof(int) * ranks * ranks);
+      for(a=0; a<ranks; a++)
+         for(b=a+1; b<ranks; b++) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+               printf("Unable to create a socket between ranks %d and %d\n", a, b);
+               exit(1);
+            }
+            linkFds[a * ranks + b] = fds[0];
+            linkFds[b * ranks + a] = fds[1];
+         }
+   } else {
+      rings = mmap(NULL, sizeof(struct ring) * ranks * ranks, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (rings == MAP_FAILED) {
+         printf("Unable to map %d shared memory rings\n", ranks * ranks);
+         exit(1);
+      }
+      for(a=0; a<ranks * ranks; a++) {
+         atomic_init(&rings[a].written, 0);
+         atomic_init(&rings[a].read, 0);
+      }
+   }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// make room for count boids in a list
+void reserveBoids(struct boidList *list, int count) {
+
+   if (count <= list->capacity)
+      return;
+   list->capacity = count * 2;
+   list->boid = realloc(list->boid, sizeof(float) * 6 * list->capacity);
+   if (list->boid == NULL) {
+      printf("rank %d: unable to allocate %d boids\n", rank, list->capacity);
+      exit(1);
+   }
+}
+
+// add a boid to the end of a list
+void appendBoid(struct boidList *list, float *boid) {
+   reserveBoids(list, list->count + 1);
+   memcpy(list->boid[list->count], boid, sizeof(float) * 6);
+   list->count++;
+}
+
+// send a list to peer and receive peer's list into arriving, the lower
+// rank sends first so two ranks never both wait to send
+void exchangeBoids(int peer, struct boidList *list) {
+
+   // variables
+   int size;
+
+
+   if (rank < peer) {
+      transport->sendBytes(peer, &list->count, sizeof(int));
+      transport->sendBytes(peer, list->boid, sizeof(float) * 6 * list->count);
+   }
+
+   transport->recvBytes(peer, &size, sizeof(int));
+   reserveBoids(&arriving, size);
+   transport->recvBytes(peer, arriving.boid, sizeof(float) * 6 * size);
+   arriving.count = size;
+
+   if (rank > peer) {
+      transport->sendBytes(peer, &list->count, sizeof(int));
+      transport->sendBytes(peer, list->boid, sizeof(float) * 6 * list->count);
+   }
+}
+
+// add values element by element across all ranks, every rank gets the
+// total. rank 0 adds them up in rank order so every rank sees the same
+// float result
+void allreduce(double *values, int size) {
+
+   // variables
+   int peer, k;
+   double *part;
+
+
+   if (rank == 0) {
+      part = malloc(sizeof(double) * size);
+      for(peer=1; peer<ranks; peer++) {
+         transport->recvBytes(peer, part, sizeof(double) * size);
+         for(k=0; k<size; k++)
+            values[k] += part[k];
+      }
+      for(peer=1; peer<ranks; peer++)
+         transport->sendBytes(peer, values, sizeof(double) * size);
+      free(part);
+   } else {
+      transport->sendBytes(0, values, sizeof(double) * size);
+      transport->recvBytes(0, values, sizeof(double) * size);
+   }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// direction moveFlock() pulls on iteration t, as moveFlock() in boids.c
+int flockSignAt(int t) {
+   return((t / 200) % 2 == 0 ? -1 : 1);
+}
+
+// send neighbours the boids they need for rule 2
+void exchangeHalo() {
+
+   // variables
+   int i;
+   int side;
+
+
+   halo.count = 0;
+   leaving[0].count = 0;
+   leaving[1].count = 0;
+   for(i=0; i<own.count; i++) {
+      if (own.boid[i][BX] < slabLow + SEPARATION)
+         appendBoid(&leaving[0], own.boid[i]);
+      if (own.boid[i][BX] >= slabHigh - SEPARATION)
+         appendBoid(&leaving[1], own.boid[i]);
+   }
+
+   // left neighbour first then right, ranks in a row never wait on
+   // each other in a circle
+   for(side=0; side<2; side++) {
+      if ((side == 0 && rank == 0) || (side == 1 && rank == ranks - 1))
+         continue;
+      exchangeBoids(side == 0 ? rank - 1 : rank + 1, &leaving[side]);
+      for(i=0; i<arriving.count; i++)
+         appendBoid(&halo, arriving.boid[i]);
+   }
+}
+
+// hand boids that left the slab to the neighbour on that side, a fast
+// boid may cross several slabs so repeat until none are left over
+void migrateBoids() {
+
+   // variables
+   int i, side;
+   int kept;
+   double misplaced[1];
+
+
+   do {
+      leaving[0].count = 0;
+      leaving[1].count = 0;
+      kept = 0;
+      for(i=0; i<own.count; i++) {
+         if (own.boid[i][BX] < slabLow)
+            appendBoid(&leaving[0], own.boid[i]);
+         else if (own.boid[i][BX] >= slabHigh)
+            appendBoid(&leaving[1], own.boid[i]);
+         else
+            memmove(own.boid[kept++], own.boid[i], sizeof(float) * 6);
+      }
+      own.count = kept;
+      migrated += leaving[0].count + leaving[1].count;
+
+      for(side=0; side<2; side++) {
+         if ((side == 0 && rank == 0) || (side == 1 && rank == ranks - 1))
+            continue;
+         exchangeBoids(side == 0 ? rank - 1 : rank + 1, &leaving[side]);
+         for(i=0; i<arriving.count; i++)
+            appendBoid(&own, arriving.boid[i]);
+      }
+
+      // boids that arrived may still be outside this slab
+      misplaced[0] = 0.0;
+      for(i=0; i<own.count; i++)
+         if (own.boid[i][BX] < slabLow || own.boid[i][BX] >= slabHigh)
+            misplaced[0] += 1.0;
+      allreduce(misplaced, 1);
+   } while(misplaced[0] > 0.0);
+}
+
+// rules 1 to 3 and moveFlock() for this rank's boids, then move them
+void moveBoids(double *sums, int sign) {
+
+   // variables
+   int i, j, k;
+   float centre[3];
+   float velocity[3];
+   float cx, cy, cz;
+   float dx, dy, dz;
+   float pull;
+   int list;
+   struct boidList *other;
+   struct boidList *lists[2] = { &own, &halo };
+
+
+   if (own.count > updateCapacity) {
+      updateCapacity = own.count * 2;
+      boidUpdate = realloc(boidUpdate, sizeof(float) * 3 * updateCapacity);
+      if (boidUpdate == NULL) {
+         printf("rank %d: unable to allocate %d boids\n", rank, updateCapacity);
+         exit(1);
+      }
+   }
+
+   for(k=0; k<3; k++) {
+      centre[k] = sums[BX + k] / popsize;
+      velocity[k] = sums[VX + k] / popsize;
+   }
+   pull = (sign == 1) ? 40.0 : 60.0;
+
+   for(i=0; i<own.count; i++) {
+
+      // rule 1
+      for(k=0; k<3; k++)
+         boidUpdate[i][k] = (centre[k] - own.boid[i][BX + k])/popsize;
+
+      // rule 2, from this rank's boids and the halo
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(list=0; list<2; list++) {
+         other = lists[list];
+         for(j=0; j<other->count; j++) {
+            if (list == 0 && i == j)
+               continue;		// calculate when not the same boid
+            dx = other->boid[j][BX] - own.boid[i][BX];
+            dy = other->boid[j][BY] - own.boid[i][BY];
+            dz = other->boid[j][BZ] - own.boid[i][BZ];
+            if (sqrtf(powf(dx,2.0) + powf(dy,2.0) + powf(dz,2.0)) < SEPARATION) {
+               cx = cx - dx;
+               cy = cy - dy;
+               cz = cz - dz;
+            }
+         }
+      }
+      boidUpdate[i][0] += cx;
+      boidUpdate[i][1] += cy;
+      boidUpdate[i][2] += cz;
+
+      // rule 3 and moveFlock()
+      for(k=0; k<3; k++)
+         boidUpdate[i][k] += (velocity[k] - own.boid[i][VX + k])/8.0;
+      for(k=0; k<3; k++)
+         boidUpdate[i][k] += (pull - own.boid[i][BX + k])/200.0;
+   }
+
+   // rule 2 has read every position so the boids can move
+   for(i=0; i<own.count; i++) {
+      for(k=0; k<3; k++) {
+         own.boid[i][VX + k] += boidUpdate[i][k];
+         own.boid[i][BX + k] += own.boid[i][VX + k];
+      }
+   }
+}
+
+// place the boids, every rank draws the whole flock from the same seed
+// and keeps the ones in its slab
+void initBoids(unsigned int seed) {
+
+   // variables
+   int i;
+   float boid[6];
+
+
+   for(i=0; i<popsize; i++) {
+      boid[BX] = (float) (rand_r(&seed) % SCREENSIZE);
+      boid[BY] = (float) (rand_r(&seed) % SCREENSIZE);
+      boid[BZ] = (float) (rand_r(&seed) % SCREENSIZE);
+      boid[VX] = 0.0;
+      boid[VY] = 0.0;
+      boid[VZ] = 0.0;
+      if (boid[BX] >= slabLow && boid[BX] < slabHigh)
+         appendBoid(&own, boid);
+   }
+}
+
+// everything one rank does
+void runRank(unsigned int seed) {
+
+   // variables
+   int i, k;
+   double sums[SUMS];
+   double *stats;
+   struct timespec stepStart;
+   struct timespec stepMid;
+   struct timespec stepEnd;
+
+
+   // slabs share the starting area evenly, the outer two reach to
+   // infinity so every boid is in exactly one slab
+   slabLow = (rank == 0) ? -FLT_MAX : (float)SCREENSIZE * rank / ranks;
+   slabHigh = (rank == ranks - 1) ? FLT_MAX : (float)SCREENSIZE * (rank + 1) / ranks;
+   initBoids(seed);
+
+   /*** Start timing here ***/
+   clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+   for(i=0; i<count; i++) {
+      clock_gettime(CLOCK_MONOTONIC, &stepStart);
+
+      // sums of the whole flock for rule 1 and rule 3
+      for(k=0; k<SUMS; k++)
+         sums[k] = 0.0;
+      for(k=0; k<own.count; k++) {
+         sums[BX] += own.boid[k][BX];
+         sums[BY] += own.boid[k][BY];
+         sums[BZ] += own.boid[k][BZ];
+         sums[VX] += own.boid[k][VX];
+         sums[VY] += own.boid[k][VY];
+         sums[VZ] += own.boid[k][VZ];
+      }
+      sums[6] = own.count;
+      allreduce(sums, SUMS);
+      exchangeHalo();
+
+      clock_gettime(CLOCK_MONOTONIC, &stepMid);
+      moveBoids(sums, flockSignAt(i));
+      clock_gettime(CLOCK_MONOTONIC, &stepEnd);
+      computeTime += secondsBetween(&stepMid, &stepEnd);
+      commTime += secondsBetween(&stepStart, &stepMid);
+
+      migrateBoids();
+      clock_gettime(CLOCK_MONOTONIC, &stepStart);
+      commTime += secondsBetween(&stepEnd, &stepStart);
+   }
+
+   /*** End timing here ***/
+   clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+   elapsedTime = secondsBetween(&startTime, &endTime);
+
+   // gather the final sums and each rank's numbers on every rank
+   for(k=0; k<SUMS; k++)
+      sums[k] = 0.0;
+   for(k=0; k<own.count; k++)
+      for(i=0; i<3; i++)
+         sums[BX + i] += own.boid[k][BX + i];
+   sums[6] = own.count;
+   allreduce(sums, SUMS);
+
+   stats = calloc(4 * ranks, sizeof(double));
+   stats[rank * 4 + 0] = own.count;
+   stats[rank * 4 + 1] = computeTime;
+   stats[rank * 4 + 2] = commTime;
+   stats[rank * 4 + 3] = migrated;
+   allreduce(stats, 4 * ranks);
+
+   if (rank == 0) {
+      for(k=0; k<ranks; k++)
+         printf("\trank %d: %.0lf boids compute %lf transport %lf migrated %.0lf\n",
+            k, stats[k * 4 + 0], stats[k * 4 + 1], stats[k * 4 + 2], stats[k * 4 + 3]);
+      printf("Centre of mass (%.3lf, %.3lf, %.3lf) of %.0lf boids\n",
+         sums[BX] / sums[6], sums[BY] / sums[6], sums[BZ] / sums[6], sums[6]);
+      printf("Time elapsed %lf\n", elapsedTime);
+   }
+   free(stats);
+}
+
+int main(int argc, char *argv[]) {
+
+   // variables
+   int i;
+   int argPtr;
+   unsigned int seed;
+   pid_t *children;
+
+
+   // assign intial values
+   popsize = POPSIZE;
+   count = ITERATIONS;
+   ranks = RANKS;
+   seed = SEED;
+   transport = &socketTransport;
+
+
+   // read command line arguments
+   if (argc > 1) {
+      argPtr = 1;
+      while(argPtr < argc) {
+         if (strcmp(argv[argPtr], "-i") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &count);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-c") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &popsize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-p") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &ranks);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-s") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%u", &seed);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-m") == 0 && argPtr+1 < argc
+          && (strcmp(argv[argPtr+1], "socket") == 0 || strcmp(argv[argPtr+1], "shm") == 0)) {
+            transport = (strcmp(argv[argPtr+1], "shm") == 0) ? &ringTransport : &socketTransport;
+            argPtr += 2;
+         } else {
+            argPtr = argc;
+            ranks = 0;
+         }
+      }
+   }
+
+   // a slab narrower than 5.0 would need a halo from beyond its neighbours
+   if (ranks < 1 || ranks > SCREENSIZE / SEPARATION || popsize < 1 || count < 0) {
+      printf("USAGE: %s <-i iterations> <-c pop_size> <-p processes> <-m transport> <-s seed>\n", argv[0]);
+      printf("\n");
+      printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+      printf("\n");
+      printf("   iterations -the number of times the population will be updated\n");
+      printf("\n");
+      printf("   pop_size -the number of boids in the whole flock\n");
+      printf("\n");
+      printf("   processes -the number of slabs, one process each, at most %d\n", (int)(SCREENSIZE / SEPARATION));
+      printf("   so no slab is narrower than the rule 2 distance\n");
+      printf("\n");
+      printf("   transport -socket (default) for Unix domain sockets or shm for\n");
+      printf("   shared memory rings\n");
+      printf("\n");
+      printf("   seed -the seed for the initial positions\n");
+      printf("\n");
+      printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n\n");
+      exit(1);
+   }
+
+   printf("Number of iterations %d\n", count);
+   printf("Number of boids %d\n", popsize);
+   printf("Number of processes %d over %s\n", ranks, transport->name);
+   fflush(stdout);
+
+
+   // links are made before forking so every rank inherits them
+   openTransport();
+
+   children = malloc(sizeof(pid_t) * ranks);
+   for(i=1; i<ranks; i++) {
+      children[i] = fork();
+      if (children[i] == 0) {
+         rank = i;
+         runRank(seed);
+         exit(0);
+      } else if (children[i] < 0) {
+         printf("Unable to start rank %d\n", i);
+         exit(1);
+      }
+   }
+
+   rank = 0;
+   runRank(seed);
+
+   for(i=1; i<ranks; i++)
+      waitpid(children[i], NULL, 0);
+   free(children);
+}
@@ -0,0 +1,667 @@
+/* Boids streamed from a file, for populations larger than memory
+   -Boids algorithms from "Boids Pseudocode:
+   http://www.kfish.org/boids/pseudocode.html
+
+   the boids are kept in a memory mapped file instead of arrays. the file
+   holds two copies of the flock, one is read while the next iteration is
+   written to the other, as data.c does with its barriers between reading
+   and updating. the boids are stored sorted by x and cut into tiles of
+   tilesize boids. rule 2 only needs boids within 5.0 so each tile only
+   reads itself and the tiles whose x range comes within 5.0 of its own,
+   its halo. while one tile is computed the next tile and its halo are
+   read ahead with madvise(MADV_WILLNEED), and tiles that are no longer
+   needed are dropped so only a window of the file is resident.
+
+   boids move so the order slowly stops being sorted. each tile is sorted
+   again as it is written and a re-bucketing pass then merges neighbouring
+   tiles, even pairs on even iterations and odd pairs on odd iterations,
+   which moves boids that crossed a tile boundary into the right tile.
+   the halo is found from each tile's actual x range so the result is
+   the same whether or not the order is fully sorted, only the size of
+   the halo changes.
+*/
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// include
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<string.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// default population size, number of boids
+#define POPSIZE 1000000
+
+// maximum screen size, both height and width
+#define SCREENSIZE 100
+
+// default number of iterations
+#define ITERATIONS 10
+
+// default number of boids in a tile
+#define TILESIZE 65536
+
+// default seed for the initial positions
+#define SEED 1
+
+// default file holding the boids
+#define STREAMFILE "boids.stream"
+
+// identifies a boid stream file
+#define STREAMMAGIC 0x42444953
+
+// rule 2 only looks at boids closer than this
+#define SEPARATION 5.0
+
+// squared form of rule 2's distance(i,j) < 5.0 test, this is the largest
+// float below 25 so d*d < SEPARATION2 gives the same answer as
+// sqrtf(d*d) < 5.0 for every float without needing the square root
+#define SEPARATION2 0x1.8ffffep+4f
+
+// boid location (x,y,z) and velocity (vx,vy,vz), 6 floats per boid
+#define BX 0
+#define BY 1
+#define BZ 2
+#define VX 3
+#define VY 4
+#define VZ 5
+#define BOIDFLOATS 6
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// start of the file, followed by the two copies of the flock
+struct streamHeader {
+   int magic;
+   // copy of the flock that holds the current iteration, 0 or 1
+   int current;
+   long popsize;
+   long tilesize;
+   // iterations already run, keeps moveFlock() going when resumed
+   long iteration;
+   char pad[32];
+};
+
+// x range of the boids in one tile
+struct tileRange {
+   float minx;
+   float maxx;
+};
+
+// variables
+// number of boids, boids per tile and number of tiles
+long popsize;
+long tilesize;
+long tilecount;
+// file holding the boids and its mapping
+char *streamFile;
+int streamFd;
+size_t streamSize;
+struct streamHeader *header;
+// the two copies of the flock inside the mapping
+float *flockCopy[2];
+// x range of every tile of the current and next copy
+struct tileRange *tileRanges;
+struct tileRange *nextRanges;
+// sums of position and velocity of the current and next copy, kept in
+// double since float sums of billions of boids lose the centre
+double flockSums[6];
+double nextSums[6];
+// for each tile, the largest maxx of it and every tile before it and the
+// smallest minx of it and every tile after it, lets the halo search stop
+// as soon as no further tile can come within 5.0
+float *prefixMax;
+float *suffixMin;
+// boids of two neighbouring tiles while they are merged
+float *mergeBuffer;
+// system page size, madvise() ranges are rounded out to it
+long pageSize;
+
+// statistics
+long haloTiles;
+long prefetchBytes;
+long rebucketMoves;
+
+// timing
+struct timespec startTime;
+struct timespec endTime;
+double elapsedTime;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// first boid of tile t in a copy of the flock
+float *tileBoids(float *copy, long t) {
+   return(&copy[t * tilesize * BOIDFLOATS]);
+}
+
+// number of boids in tile t, the last tile may be short
+long tileLength(long t) {
+   if (t == tilecount - 1)
+      return(popsize - t * tilesize);
+   return(tilesize);
+}
+
+// apply advice to the pages holding tiles [first, last] of a copy
+void adviseTiles(float *copy, long first, long last, int advice) {
+
+   // variables
+   char *start;
+   char *end;
+
+
+   start = (char *)tileBoids(copy, first);
+   end = (char *)(tileBoids(copy, last) + tileLength(last) * BOIDFLOATS);
+
+   // round out to whole pages, madvise() needs an aligned start
+   start = (char *)((unsigned long)start & ~(pageSize - 1));
+   madvise(start, end - start, advice);
+
+   if (advice == MADV_WILLNEED)
+      prefetchBytes += end - start;
+}
+
+// x range of the boids in tile t of a copy
+void measureTile(float *copy, long t, struct tileRange *range) {
+
+   // variables
+   long i;
+   float *boid;
+
+
+   boid = tileBoids(copy, t);
+   range->minx = boid[BX];
+   range->maxx = boid[BX];
+   for(i=1; i<tileLength(t); i++) {
+      if (boid[i*BOIDFLOATS + BX] < range->minx)
+         range->minx = boid[i*BOIDFLOATS + BX];
+      if (boid[i*BOIDFLOATS + BX] > range->maxx)
+         range->maxx = boid[i*BOIDFLOATS + BX];
+   }
+}
+
+// rebuild prefixMax[] and suffixMin[] from tileRanges[]
+void indexTiles() {
+
+   // variables
+   long t;
+
+
+   prefixMax[0] = tileRanges[0].maxx;
+   for(t=1; t<tilecount; t++)
+      prefixMax[t] = fmaxf(prefixMax[t-1], tileRanges[t].maxx);
+
+   suffixMin[tilecount-1] = tileRanges[tilecount-1].minx;
+   for(t=tilecount-2; t>=0; t--)
+      suffixMin[t] = fminf(suffixMin[t+1], tileRanges[t].minx);
+}
+
+// lowest and highest tile that may hold a boid within 5.0 of tile t, the
+// tiles in between that do not are skipped by haloNeeded()
+void haloBounds(long t, long *first, long *last) {
+
+   // variables
+   float low;
+   float high;
+
+
+   low = tileRanges[t].minx - SEPARATION;
+   high = tileRanges[t].maxx + SEPARATION;
+
+   *first = t;
+   while(*first > 0 && prefixMax[*first - 1] >= low)
+      (*first)--;
+
+   *last = t;
+   while(*last < tilecount - 1 && suffixMin[*last + 1] <= high)
+      (*last)++;
+}
+
+// 1 when tile k comes within 5.0 of tile t
+int haloNeeded(long t, long k) {
+   return(tileRanges[k].maxx >= tileRanges[t].minx - SEPARATION
+       && tileRanges[k].minx <= tileRanges[t].maxx + SEPARATION);
+}
+
+// order boids by x
+int compareBoids(const void *a, const void *b) {
+
+   // variables
+   float ax = ((const float *)a)[BX];
+   float bx = ((const float *)b)[BX];
+
+   return((ax > bx) - (ax < bx));
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// direction moveFlock() pulls on iteration t, as moveFlock() in boids.c
+int flockSignAt(long t) {
+   return((t / 200) % 2 == 0 ? -1 : 1);
+}
+
+// move the boids of tile t from the current copy into the next copy
+void moveTile(long t, int sign) {
+
+   // variables
+   long i, j, k;
+   long first, last;
+   long length;
+   float *boid;
+   float *other;
+   float *next;
+   float ux, uy, uz;
+   float cx, cy, cz;
+   float dx, dy, dz;
+   float centre[3];
+   float velocity[3];
+   float px;
+
+
+   boid = tileBoids(flockCopy[header->current], t);
+   next = tileBoids(flockCopy[1 - header->current], t);
+   length = tileLength(t);
+   haloBounds(t, &first, &last);
+
+   // centre of mass and average velocity of the whole flock
+   for(k=0; k<3; k++) {
+      centre[k] = flockSums[BX + k] / popsize;
+      velocity[k] = flockSums[VX + k] / popsize;
+   }
+
+   // moveFlock() pulls towards (40,40,40) or (60,60,60)
+   px = (sign == 1) ? 40.0 : 60.0;
+
+   for(i=0; i<length; i++) {
+
+      // rule 1, move towards centre of mass
+      ux = (centre[0] - boid[i*BOIDFLOATS + BX]) / popsize;
+      uy = (centre[1] - boid[i*BOIDFLOATS + BY]) / popsize;
+      uz = (centre[2] - boid[i*BOIDFLOATS + BZ]) / popsize;
+
+      // rule 2, keep boids from overlapping, only the halo can be close
+      cx = 0.0; cy = 0.0; cz = 0.0;
+      for(k=first; k<=last; k++) {
+         if (!haloNeeded(t, k))
+            continue;
+         other = tileBoids(flockCopy[header->current], k);
+         for(j=0; j<tileLength(k); j++) {
+            if (k == t && i == j)
+               continue;		// calculate when not the same boid
+            dx = other[j*BOIDFLOATS + BX] - boid[i*BOIDFLOATS + BX];
+            dy = other[j*BOIDFLOATS + BY] - boid[i*BOIDFLOATS + BY];
+            dz = other[j*BOIDFLOATS + BZ] - boid[i*BOIDFLOATS + BZ];
+            if (dx*dx + dy*dy + dz*dz < SEPARATION2) {
+               cx = cx - dx;
+               cy = cy - dy;
+               cz = cz - dz;
+            }
+         }
+      }
+      ux += cx;
+      uy += cy;
+      uz += cz;
+
+      // rule 3, match the average velocity
+      ux += (velocity[0] - boid[i*BOIDFLOATS + VX])/8.0;
+      uy += (velocity[1] - boid[i*BOIDFLOATS + VY])/8.0;
+      uz += (velocity[2] - boid[i*BOIDFLOATS + VZ])/8.0;
+
+      // moveFlock()
+      ux += (px - boid[i*BOIDFLOATS + BX])/200.0;
+      uy += (px - boid[i*BOIDFLOATS + BY])/200.0;
+      uz += (px - boid[i*BOIDFLOATS + BZ])/200.0;
+
+      // update velocity and position into the next copy
+      next[i*BOIDFLOATS + VX] = boid[i*BOIDFLOATS + VX] + ux;
+      next[i*BOIDFLOATS + VY] = boid[i*BOIDFLOATS + VY] + uy;
+      next[i*BOIDFLOATS + VZ] = boid[i*BOIDFLOATS + VZ] + uz;
+      next[i*BOIDFLOATS + BX] = boid[i*BOIDFLOATS + BX] + next[i*BOIDFLOATS + VX];
+      next[i*BOIDFLOATS + BY] = boid[i*BOIDFLOATS + BY] + next[i*BOIDFLOATS + VY];
+      next[i*BOIDFLOATS + BZ] = boid[i*BOIDFLOATS + BZ] + next[i*BOIDFLOATS + VZ];
+
+      for(k=0; k<6; k++)
+         nextSums[k] += next[i*BOIDFLOATS + k];
+   }
+
+   for(k=first; k<=last; k++)
+      haloTiles += haloNeeded(t, k);
+
+   // keep the tile sorted for the re-bucketing pass
+   qsort(next, length, sizeof(float) * BOIDFLOATS, compareBoids);
+   measureTile(flockCopy[1 - header->current], t, &nextRanges[t]);
+}
+
+// merge tiles t and t+1 of the current copy so every boid of tile t has
+// an x no larger than any boid of tile t+1, both tiles are sorted
+void mergeTiles(long t) {
+
+   // variables
+   long i, a, b;
+   long lengthA, lengthB;
+   float *tileA;
+   float *tileB;
+
+
+   tileA = tileBoids(flockCopy[header->current], t);
+   tileB = tileBoids(flockCopy[header->current], t + 1);
+   lengthA = tileLength(t);
+   lengthB = tileLength(t + 1);
+
+   // already in order, nothing crossed the boundary
+   if (tileA[(lengthA - 1)*BOIDFLOATS + BX] <= tileB[BX])
+      return;
+
+   a = 0; b = 0;
+   for(i=0; i<lengthA + lengthB; i++) {
+      if (b >= lengthB || (a < lengthA && tileA[a*BOIDFLOATS + BX] <= tileB[b*BOIDFLOATS + BX])) {
+         memcpy(&mergeBuffer[i*BOIDFLOATS], &tileA[a*BOIDFLOATS], sizeof(float) * BOIDFLOATS);
+         a++;
+      } else {
+         memcpy(&mergeBuffer[i*BOIDFLOATS], &tileB[b*BOIDFLOATS], sizeof(float) * BOIDFLOATS);
+         b++;
+         // a boid from tile t+1 that ends up in tile t
+         if (i < lengthA)
+            rebucketMoves++;
+      }
+   }
+
+   // the tiles are next to each other in the file
+   memcpy(tileA, mergeBuffer, sizeof(float) * BOIDFLOATS * (lengthA + lengthB));
+   measureTile(flockCopy[header->current], t, &tileRanges[t]);
+   measureTile(flockCopy[header->current], t + 1, &tileRanges[t + 1]);
+}
+
+// move every boid one iteration
+void moveBoids() {
+
+   // variables
+   long t, k;
+   long first, last;
+   long nextFirst, nextLast;
+   long released;
+   int current;
+
+
+   current = header->current;
+   released = 0;
+   for(k=0; k<6; k++)
+      nextSums[k] = 0.0;
+
+   for(t=0; t<tilecount; t++) {
+
+      // read the next tile and its halo while this one is computed
+      if (t + 1 < tilecount) {
+         haloBounds(t + 1, &nextFirst, &nextLast);
+         adviseTiles(flockCopy[current], nextFirst, nextLast, MADV_WILLNEED);
+      }
+
+      // tiles below this tile's halo are unlikely to be read again this
+      // iteration and written tiles are not needed until the next one.
+      // the mapping is shared so dropped pages stay in the file
+      haloBounds(t, &first, &last);
+      if (first > released) {
+         adviseTiles(flockCopy[current], released, first - 1, MADV_DONTNEED);
+         released = first;
+      }
+      if (t > 0)
+         adviseTiles(flockCopy[1 - current], t - 1, t - 1, MADV_DONTNEED);
+
+      moveTile(t, flockSignAt(header->iteration));
+   }
+
+   // the copy just written becomes the current one
+   header->current = 1 - current;
+   header->iteration++;
+   memcpy(flockSums, nextSums, sizeof(flockSums));
+   memcpy(tileRanges, nextRanges, sizeof(struct tileRange) * tilecount);
+
+   // re-bucket, even pairs then odd pairs on alternate iterations. the
+   // tiles are merged in file order so plain readahead is enough
+   adviseTiles(flockCopy[header->current], 0, tilecount - 1, MADV_SEQUENTIAL);
+   for(t = header->iteration % 2; t + 1 < tilecount; t += 2)
+      mergeTiles(t);
+   adviseTiles(flockCopy[header->current], 0, tilecount - 1, MADV_NORMAL);
+   indexTiles();
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// place the boids in the current copy, sorted by x
+void initBoids(unsigned int seed) {
+
+   // variables
+   long i;
+   float *boid;
+
+
+   boid = flockCopy[header->current];
+
+   // x is spread evenly in boid order so the file starts sorted, y and z
+   // are random as in boids.c
+   for(i=0; i<popsize; i++) {
+      boid[i*BOIDFLOATS + BX] = (float) (i * SCREENSIZE / popsize);
+      boid[i*BOIDFLOATS + BY] = (float) (rand_r(&seed) % SCREENSIZE);
+      boid[i*BOIDFLOATS + BZ] = (float) (rand_r(&seed) % SCREENSIZE);
+      boid[i*BOIDFLOATS + VX] = 0.0;
+      boid[i*BOIDFLOATS + VY] = 0.0;
+      boid[i*BOIDFLOATS + VZ] = 0.0;
+   }
+}
+
+// open or create the stream file and map both copies of the flock
+void openStream(int resume) {
+
+   // variables
+   struct streamHeader existing;
+
+
+   streamSize = sizeof(struct streamHeader) + 2 * (size_t)popsize * BOIDFLOATS * sizeof(float);
+
+   if (resume) {
+      streamFd = open(streamFile, O_RDWR);
+      if (streamFd < 0 || read(streamFd, &existing, sizeof(existing)) != sizeof(existing)
+       || existing.magic != STREAMMAGIC) {
+         printf("Unable to resume from %s\n", streamFile);
+         exit(1);
+      }
+      popsize = existing.popsize;
+      tilesize = existing.tilesize;
+      streamSize = sizeof(struct streamHeader) + 2 * (size_t)popsize * BOIDFLOATS * sizeof(float);
+   } else {
+      streamFd = open(streamFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (streamFd < 0 || ftruncate(streamFd, streamSize) != 0) {
+         printf("Unable to create %s for %ld boids\n", streamFile, popsize);
+         exit(1);
+      }
+   }
+
+   header = mmap(NULL, streamSize, PROT_READ | PROT_WRITE, MAP_SHARED, streamFd, 0);
+   if (header == MAP_FAILED) {
+      printf("Unable to map %s\n", streamFile);
+      exit(1);
+   }
+
+   flockCopy[0] = (float *)(header + 1);
+   flockCopy[1] = flockCopy[0] + (size_t)popsize * BOIDFLOATS;
+
+   if (!resume) {
+      header->magic = STREAMMAGIC;
+      header->current = 0;
+      header->popsize = popsize;
+      header->tilesize = tilesize;
+      header->iteration = 0;
+   }
+}
+
+// allocate the per tile arrays and measure the current copy
+void allocateTiles() {
+
+   // variables
+   long t, i;
+   int k;
+   float *boid;
+
+
+   tilecount = (popsize + tilesize - 1) / tilesize;
+   tileRanges = malloc(sizeof(struct tileRange) * tilecount);
+   nextRanges = malloc(sizeof(struct tileRange) * tilecount);
+   prefixMax = malloc(sizeof(float) * tilecount);
+   suffixMin = malloc(sizeof(float) * tilecount);
+   mergeBuffer = malloc(sizeof(float) * BOIDFLOATS * 2 * tilesize);
+   if (tileRanges == NULL || nextRanges == NULL || prefixMax == NULL
+    || suffixMin == NULL || mergeBuffer == NULL) {
+      printf("Unable to allocate %ld tiles\n", tilecount);
+      exit(1);
+   }
+
+   // one streaming pass for the sums and ranges, later iterations get
+   // them while writing
+   for(k=0; k<6; k++)
+      flockSums[k] = 0.0;
+   adviseTiles(flockCopy[header->current], 0, tilecount - 1, MADV_SEQUENTIAL);
+   for(t=0; t<tilecount; t++) {
+      boid = tileBoids(flockCopy[header->current], t);
+      qsort(boid, tileLength(t), sizeof(float) * BOIDFLOATS, compareBoids);
+      for(i=0; i<tileLength(t); i++)
+         for(k=0; k<6; k++)
+            flockSums[k] += boid[i*BOIDFLOATS + k];
+      measureTile(flockCopy[header->current], t, &tileRanges[t]);
+   }
+   adviseTiles(flockCopy[header->current], 0, tilecount - 1, MADV_NORMAL);
+   indexTiles();
+}
+
+int main(int argc, char *argv[]) {
+
+   // variables
+   long i;
+   int count;
+   int argPtr;
+   int resume;
+   unsigned int seed;
+
+
+   // assign intial values
+   popsize = POPSIZE;
+   tilesize = TILESIZE;
+   count = ITERATIONS;
+   seed = SEED;
+   streamFile = STREAMFILE;
+   resume = 0;
+   pageSize = sysconf(_SC_PAGESIZE);
+
+
+   // read command line arguments
+   if (argc > 1) {
+      argPtr = 1;
+      while(argPtr < argc) {
+         if (strcmp(argv[argPtr], "-i") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%d", &count);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-c") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%ld", &popsize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-k") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%ld", &tilesize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-f") == 0 && argPtr+1 < argc) {
+            streamFile = argv[argPtr+1];
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-s") == 0 && argPtr+1 < argc) {
+            sscanf(argv[argPtr+1], "%u", &seed);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-r") == 0) {
+            resume = 1;
+            argPtr += 1;
+         } else {
+            argPtr = argc;
+            popsize = 0;
+         }
+      }
+   }
+
+   if (popsize < 2 || tilesize < 1 || count < 0) {
+      printf("USAGE: %s <-i iterations> <-c pop_size> <-k tile_size> <-f file> <-s seed> <-r>\n", argv[0]);
+      printf("\n");
+      printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+      printf("\n");
+      printf("   iterations -the number of times the population will be updated\n");
+      printf("\n");
+      printf("   pop_size -the number of boids to create, the file needs %d bytes\n", (int)(2 * BOIDFLOATS * sizeof(float)));
+      printf("   per boid and only a few tiles are in memory at a time\n");
+      printf("\n");
+      printf("   tile_size -the number of boids in each tile (default %d)\n", TILESIZE);
+      printf("\n");
+      printf("   file -the file holding the boids (default %s)\n", STREAMFILE);
+      printf("\n");
+      printf("   seed -the seed for the initial positions\n");
+      printf("\n");
+      printf("   -r -continue from the boids already in file, pop_size and\n");
+      printf("   tile_size are read from the file\n");
+      printf("\n");
+      printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n\n");
+      exit(1);
+   }
+
+
+   // map the file and place the boids
+   openStream(resume);
+   if (!resume)
+      initBoids(seed);
+   allocateTiles();
+
+   printf("Number of iterations %d\n", count);
+   printf("Number of boids %ld\n", popsize);
+   printf("Number of tiles %ld of %ld boids\n", tilecount, tilesize);
+   printf("Stream file %s, %.1lf MB\n", streamFile, streamSize / (1024.0 * 1024.0));
+   if (resume)
+      printf("Resuming at iteration %ld\n", header->iteration);
+
+
+   /*** Start timing here ***/
+   clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+   for(i=0; i<count; i++)
+      moveBoids();
+
+   // the file is complete once it is written back
+   msync(header, streamSize, MS_SYNC);
+
+   /*** End timing here ***/
+   clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+
+   elapsedTime = (endTime.tv_sec - startTime.tv_sec);
+   elapsedTime += (endTime.tv_nsec - startTime.tv_nsec) / 1000000000.0;
+
+   printf("Centre of mass (%.3lf, %.3lf, %.3lf)\n",
+      flockSums[BX] / popsize, flockSums[BY] / popsize, flockSums[BZ] / popsize);
+   if (count > 0) {
+      printf("Mean halo %.2lf tiles per tile\n", (double)haloTiles / ((double)tilecount * count));
+      printf("Read ahead %.1lf MB per iteration\n", prefetchBytes / (1024.0 * 1024.0) / count);
+      printf("Boids re-bucketed %.1lf per iteration\n", (double)rebucketMoves / count);
+   }
+   printf("Time elapsed %lf\n", elapsedTime);
+   printf("Boid updates per second %lf\n", (double)popsize * count / elapsedTime);
+
+   munmap(header, streamSize);
+   close(streamFd);
+}
@@ -18,6 +18,7 @@
 #include<string.h>
 #include<pthread.h>
 #include<time.h>
+#include<stdatomic.h>
 
 // graphics
 #ifndef NOGRAPHICS
@@ -42,8 +43,21 @@
 // when graphics are turned off
 #define ITERATIONS 1000
 
-// default number of threads to run
-#define THREADS 4
+// default number of boids in each block of the task graph
+#define BLOCKSIZE 64
+
+// kinds of task in the task graph, each works on one block of boids
+// except TASKREDUCE which adds up the sums of all blocks
+#define TASKSUM 0
+#define TASKREDUCE 1
+#define TASKRULE1 2
+#define TASKRULE2 3
+#define TASKRULE3 4
+#define TASKMOVEFLOCK 5
+#define TASKUPDATE 6
+
+// default number of threads to run, one for each of the five rules
+#define THREADS 5
 
 // boid location (x,y,z) and velocity (vx,vy,vz) in boidArray[][]
 #define BX 0
@@ -68,14 +82,65 @@ int popsize;
 // location and velocity of boids
 float **boidArray;
 
-// change in velocity is stored for each boid (x,y,z)
-float **boidUpdate;
+// location and velocity of boids after this iteration, updateBoids()
+// writes here so it never changes positions rule 2 is still reading
+float **boidNext;
 
-// mutexes for each iteration for all 6 variables (BX to YZ) of boidArray
-pthread_mutex_t* mainMutexes;
+// change in velocity from rule 1 is stored for each boid (x,y,z)
+float **boidUpdate;
 
-// mutexes for each iteration for all 6 variables (BX to YZ) of boidUpdate
-pthread_mutex_t* updateMutexes;
+// change in velocity from rule 2, rule 3 and moveFlock(), kept apart so
+// the rules can run at the same time on the same block
+float **separationUpdate;
+float **alignmentUpdate;
+float **flockUpdate;
+
+// one piece of work in the task graph
+struct task {
+   // TASKSUM to TASKUPDATE
+   int type;
+   // block of boids the task works on
+   int block;
+   // number of tasks that have to finish before this one can run
+   int deps;
+   // deps still unfinished in this iteration
+   atomic_int pending;
+   // tasks waiting on this one
+   int *successors;
+   int successorsize;
+};
+
+// the task graph, the same graph is run every iteration
+struct task *taskArray;
+int tasksize;
+
+// number of boids in a block and number of blocks
+int blocksize;
+int blockcount;
+
+// position and velocity sums of each block, and of the whole flock
+float (*blockSums)[6];
+float flockSums[6];
+
+// tasks whose inputs are ready
+int *readyArray;
+int readysize;
+// tasks finished in this iteration
+int donesize;
+// protects readyArray, readysize and donesize
+pthread_mutex_t readyMutex;
+// signalled when tasks become ready or the iteration is finished
+pthread_cond_t readyCond;
+// tells the workers to exit
+int poolQuit;
+
+// the number of threads, including the main thread
+int threadsize;
+pthread_t *threadArray;
+
+// moveFlock() state, advanced once per iteration by moveBoids()
+int flockCount;
+int flockSign;
 
 // timing
 struct timespec startTime;
@@ -138,46 +203,67 @@ int drawBoids() {
 }
 #endif
 
+// sum positions and velocities of a block for rule 1 and rule 3
+void sumBlock(int block) {
+
+   // variables
+   int i, k;
+   int min, max;
+   float sums[6];
+
+
+   min = block * blocksize;
+   max = min + blocksize < popsize ? min + blocksize : popsize;
+
+   for(k=0; k<6; k++)
+      sums[k] = 0.0;
+
+   for(i=min; i<max; i++)
+      for(k=0; k<6; k++)
+         sums[k] += boidArray[i][k];
+
+   for(k=0; k<6; k++)
+      blockSums[block][k] = sums[k];
+}
+
+// add up the block sums, centre of mass and average velocity. this
+// adds the boids in a different order from boids.c's single pass, so
+// the flock matches boids.c within float rounding
+void reduceBlocks() {
+
+   // variables
+   int b, k;
+
+   for(k=0; k<6; k++)
+      flockSums[k] = 0.0;
+
+   for(b=0; b<blockcount; b++)
+      for(k=0; k<6; k++)
+         flockSums[k] += blockSums[b][k];
+
+   for(k=0; k<6; k++)
+      flockSums[k] /= popsize;
+}
+
 // rule 1
-void *rule1(void* Data) {
+void rule1(int min, int max) {
    
    // variables
    int i;
-   int j;
    float cx, cy, cz;
 
-   cx = 0.0; cy = 0.0; cz = 0.0;
-
-
-   // calculate centre of mass
-   // calculated once and used for all updates in rule 1
-   for(i=0; i<popsize; i++) {
-      
-      // lock both mutexes to start
-      pthread_mutex_lock(&mainMutexes[i]);
-      pthread_mutex_lock(&updateMutexes[i]);
-
-      cx += boidArray[i][BX];
-      cy += boidArray[i][BY];
-      cz += boidArray[i][BZ];
-   }
-   cx /= popsize;
-   cy /= popsize;
-   cz /= popsize;
+   // centre of mass, calculated once by reduceBlocks()
+   cx = flockSums[BX];
+   cy = flockSums[BY];
+   cz = flockSums[BZ];
 
    // update velocity, move towards centre of mass
    // initial use of boidUpdate[][] so overwrite old values
-   for(i=0; i<popsize; i++) {
+   for(i=min; i<max; i++) {
       boidUpdate[i][BX] = (cx - boidArray[i][BX])/popsize;
       boidUpdate[i][BY] = (cy - boidArray[i][BY])/popsize;
       boidUpdate[i][BZ] = (cz - boidArray[i][BZ])/popsize;
-
-      // unlock the threads so the next function can start
-      pthread_mutex_unlock(&mainMutexes[i]);
-      pthread_mutex_unlock(&updateMutexes[i]);
    }
-
-   return NULL;
 }
 
 // distance
@@ -191,24 +277,14 @@ float distance(int i, int j) {
 }
 
 // rule 2
-void *rule2(void* data) {
+void rule2(int min, int max) {
    
    // variables
    int i, j;
    float cx, cy, cz;
 
-   // this function is two demensional so its going to run 
-   // into all mutexes quickly, this one will wait until 
-   // all are complete from the first
-   for(i=0; i<popsize; i++) {
-      
-      // lock both mutexes to start
-      pthread_mutex_lock(&mainMutexes[i]);
-      pthread_mutex_lock(&updateMutexes[i]);
-   }
-   
    // keep boids from overlapping
-   for(i=0; i<popsize; i++) {
+   for(i=min; i<max; i++) {
       cx = 0.0; cy = 0.0; cz = 0.0;
       for(j=0; j<popsize; j++) {
          if (i != j) {		// calculate when not the same boid
@@ -218,80 +294,44 @@ void *rule2(void* data) {
                cz = cz - (boidArray[j][BZ] - boidArray[i][BZ]);
             }
          }
-
-         // if its the last iteration of i, start unlocking
-         // the mutexes at j
-         if(i==popsize-1)
-            pthread_mutex_unlock(&mainMutexes[j]);
-
       }
-      boidUpdate[i][BX] += cx;
-      boidUpdate[i][BY] += cy;
-      boidUpdate[i][BZ] += cz;
-
-      // unlock boidUpdate after
-      pthread_mutex_unlock(&updateMutexes[i]);
+      separationUpdate[i][BX] = cx;
+      separationUpdate[i][BY] = cy;
+      separationUpdate[i][BZ] = cz;
    }
-
-
-   return NULL;
 }
 
 // rule 3
-void *rule3(void* data) {
+void rule3(int min, int max) {
    
    // variables
    int i;
    float cx, cy, cz;
 
-   cx = 0.0; cy = 0.0; cz = 0.0;
-
-   // calculate average velocity
-   // calculate once and use for all updates in rule 3
-   for(i=0; i<popsize; i++) {
-      cx += boidArray[i][VX];
-      cy += boidArray[i][VY];
-      cz += boidArray[i][VZ];
-   }
-   cx /= popsize;
-   cy /= popsize;
-   cz /= popsize;
+   // average velocity, calculated once by reduceBlocks()
+   cx = flockSums[VX];
+   cy = flockSums[VY];
+   cz = flockSums[VZ];
 
    // update velocity, move towards centre of mass
-   for(i=0; i<popsize; i++) {
-      
-      // lock both mutexes to start
-      pthread_mutex_lock(&mainMutexes[i]);
-      pthread_mutex_lock(&updateMutexes[i]);
-   
-      boidUpdate[i][BX] += (cx - boidArray[i][VX])/8.0;
-      boidUpdate[i][BY] += (cy - boidArray[i][VY])/8.0;
-      boidUpdate[i][BZ] += (cz - boidArray[i][VZ])/8.0;
-
-      //unlock after they are complete
-      pthread_mutex_unlock(&mainMutexes[i]);
-      pthread_mutex_unlock(&updateMutexes[i]);
+   for(i=min; i<max; i++) {
+      alignmentUpdate[i][BX] = (cx - boidArray[i][VX])/8.0;
+      alignmentUpdate[i][BY] = (cy - boidArray[i][VY])/8.0;
+      alignmentUpdate[i][BZ] = (cz - boidArray[i][VZ])/8.0;
    }
-
-   return NULL;
 }
 
 // move the flock towards a point
-void *moveFlock(void* data) {
+void moveFlock(int min, int max) {
    
    // variables
    int i;
-   static int count = 0;
-   static int sign = 1;
    float px, py, pz;
 
 
-   // pull flock towards two points as the program runs
-   // every 200 iterations change point that flock is pulled towards
-   if (count % 200 == 0) {
-      sign = sign * -1;
-   }
-   if (sign == 1) {
+   // pull flock towards two points as the program runs, moveBoids()
+   // changes flockSign every 200 iterations
+   if (flockSign == 1) {
    // move flock towards position (40,40,40)
       px = 40.0;
       py = 40.0;
@@ -304,66 +344,189 @@ void *moveFlock(void* data) {
    }
    // add offset (px,py,pz) to each boid in order to pull it
    // towards the current target point
-   for(i=0; i<popsize; i++) {
-      
-      // lock both mutexes to start
-      pthread_mutex_lock(&mainMutexes[i]);
-      pthread_mutex_lock(&updateMutexes[i]);
-
-      boidUpdate[i][BX] += (px - boidArray[i][BX])/200.0;
-      boidUpdate[i][BY] += (py - boidArray[i][BY])/200.0;
-      boidUpdate[i][BZ] += (pz - boidArray[i][BZ])/200.0;
-
-      // unlock the mutexes after
-      pthread_mutex_unlock(&mainMutexes[i]);
-      pthread_mutex_unlock(&updateMutexes[i]);
+   for(i=min; i<max; i++) {
+      flockUpdate[i][BX] = (px - boidArray[i][BX])/200.0;
+      flockUpdate[i][BY] = (py - boidArray[i][BY])/200.0;
+      flockUpdate[i][BZ] = (pz - boidArray[i][BZ])/200.0;
    }
-   count++;
-
-   return NULL;
 }
 
 // update the boids
-void *updateBoids(void* data) {
+void updateBoids(int min, int max) {
 
    // variables 
    int i;
-   
-   // thread variables
-   int min;
-   int max;
-   int* positions;
+   int k;
+   float update;
 
-   
-   // assign
-   positions = (int*)data;
-   min = positions[0];
-   max = positions[1];
+   for (i=min; i<max; i++) {
 
-   //printf("STARTING   %d %d\n", min, max);
+      // add the rules up in the same order boids.c does
+      for(k=0; k<3; k++) {
+         update = boidUpdate[i][k];
+         update += separationUpdate[i][k];
+         update += alignmentUpdate[i][k];
+         update += flockUpdate[i][k];
 
-   for (i=0; i<popsize; i++) {
-      
-      // lock both mutexes to start
-      pthread_mutex_lock(&mainMutexes[i]);
-      pthread_mutex_lock(&updateMutexes[i]);
-
-      // update velocity for each boid
-      boidArray[i][VX] += boidUpdate[i][BX];
-      boidArray[i][VY] += boidUpdate[i][BY];
-      boidArray[i][VZ] += boidUpdate[i][BZ];
-      
-      // update position for each boid
-      boidArray[i][BX] += boidArray[i][VX];
-      boidArray[i][BY] += boidArray[i][VY];
-      boidArray[i][BZ] += boidArray[i][VZ];
-
-      // unlock the mutexes after 
-      pthread_mutex_unlock(&mainMutexes[i]);
-      pthread_mutex_unlock(&updateMutexes[i]);
+         // update velocity for each boid
+         boidNext[i][VX + k] = boidArray[i][VX + k] + update;
+
+         // update position for each boid
+         boidNext[i][BX + k] = boidArray[i][BX + k] + boidNext[i][VX + k];
+      }
    }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+// every iteration is a graph of tasks, each rule is split into one task
+// per block of boids and a task runs as soon as the tasks it depends on
+// are finished:
+//
+//    sum[k] ----> reduce ----> rule1[k] --+
+//                        \---> rule3[k] --+
+//                              rule2[k] --+--> update[k]
+//                           moveFlock[k] -+
+//
+// rule 2 and moveFlock only read positions so they can start straight
+// away and overlap with the sums. update[k] writes to boidNext so it can
+// run while rule 2 tasks of other blocks still read boidArray.
+
+
+// add a dependency, task to waits for task from
+void addDependency(int from, int to) {
+
+   taskArray[from].successors[taskArray[from].successorsize++] = to;
+   taskArray[to].deps++;
+}
+
+// build the task graph
+void buildTasks() {
+
+   // variables
+   int b, t;
+   int reduce;
+   struct task *task;
 
-   //printf("COMPLETING %d %d\n", min, max);
+   // task t of a block is kind * blockcount + block, reduce is last
+   int blockTypes[6] = {TASKSUM, TASKRULE1, TASKRULE2, TASKRULE3, TASKMOVEFLOCK, TASKUPDATE};
+
+
+   blockcount = (popsize + blocksize - 1) / blocksize;
+
+   // sum, rule1, rule2, rule3, moveFlock and update for each block plus
+   // the one reduce task
+   tasksize = blockcount * 6 + 1;
+   taskArray = malloc(sizeof(struct task) * tasksize);
+   readyArray = malloc(sizeof(int) * tasksize);
+   blockSums = malloc(sizeof(float) * 6 * blockcount);
+
+   reduce = blockcount * 6;
+   for(t=0; t<tasksize; t++) {
+      task = &taskArray[t];
+      task->type = t == reduce ? TASKREDUCE : blockTypes[t / blockcount];
+      task->block = t % blockcount;
+      task->deps = 0;
+      task->successorsize = 0;
+
+      // only reduce has more than one successor
+      task->successors = malloc(sizeof(int) * (t == reduce ? blockcount * 2 : 1));
+   }
+   taskArray[reduce].block = 0;
+
+   for(b=0; b<blockcount; b++) {
+      addDependency(b, reduce);
+      addDependency(reduce, 1 * blockcount + b);
+      addDependency(reduce, 3 * blockcount + b);
+      addDependency(1 * blockcount + b, 5 * blockcount + b);
+      addDependency(2 * blockcount + b, 5 * blockcount + b);
+      addDependency(3 * blockcount + b, 5 * blockcount + b);
+      addDependency(4 * blockcount + b, 5 * blockcount + b);
+   }
+}
+
+// run one task
+void runTask(int t) {
+
+   // variables
+   int min, max;
+
+   min = taskArray[t].block * blocksize;
+   max = min + blocksize < popsize ? min + blocksize : popsize;
+
+   switch(taskArray[t].type) {
+      case TASKSUM: sumBlock(taskArray[t].block); break;
+      case TASKREDUCE: reduceBlocks(); break;
+      case TASKRULE1: rule1(min, max); break;
+      case TASKRULE2: rule2(min, max); break;
+      case TASKRULE3: rule3(min, max); break;
+      case TASKMOVEFLOCK: moveFlock(min, max); break;
+      case TASKUPDATE: updateBoids(min, max); break;
+   }
+}
+
+// mark a task finished and make ready the tasks that were waiting on it
+void finishTask(int t) {
+
+   // variables
+   int i;
+   int next;
+   int woken;
+
+
+   woken = 0;
+   pthread_mutex_lock(&readyMutex);
+   for(i=0; i<taskArray[t].successorsize; i++) {
+      next = taskArray[t].successors[i];
+      if (atomic_fetch_sub(&taskArray[next].pending, 1) == 1) {
+         readyArray[readysize++] = next;
+         woken++;
+      }
+   }
+   donesize++;
+
+   // the main thread waits for the last task of the iteration
+   if (woken > 1 || donesize == tasksize)
+      pthread_cond_broadcast(&readyCond);
+   else if (woken == 1)
+      pthread_cond_signal(&readyCond);
+   pthread_mutex_unlock(&readyMutex);
+}
+
+// run ready tasks, the main thread returns when the iteration is finished
+// and the workers return when poolQuit is set
+void runTasks(int isMain) {
+
+   // variables
+   int t;
+
+   while(1) {
+      pthread_mutex_lock(&readyMutex);
+      while(readysize == 0 && !poolQuit && !(isMain && donesize == tasksize))
+         pthread_cond_wait(&readyCond, &readyMutex);
+
+      if (poolQuit || (isMain && donesize == tasksize && readysize == 0)) {
+         pthread_mutex_unlock(&readyMutex);
+         return;
+      }
+
+      t = readyArray[--readysize];
+      pthread_mutex_unlock(&readyMutex);
+
+      runTask(t);
+      finishTask(t);
+   }
+}
+
+// worker thread
+void *taskWorker(void *data) {
+
+   // every worker takes from the same ready queue
+   (void)data;
+
+   runTasks(0);
 
    return NULL;
 }
@@ -375,79 +538,127 @@ void *updateBoids(void* data) {
 void moveBoids() {
    
    // variables
-   int i;
+   int t;
+   float **swap;
 
-   pthread_t threadRule1;
-   pthread_t threadRule2;
-   pthread_t threadRule3;
-   pthread_t threadMoveFlock;
-   pthread_t threadMoveBoids;
-
-   // null data causes a segfault within pthread_create
-   // so indstead this variable can be used
-   void *voidier;
-
-   // give the void a size of 4
-   voidier = malloc(sizeof(int));
-
-   // run threads 
-   pthread_create(&threadRule1, NULL, rule1, voidier);
-   pthread_create(&threadRule2, NULL, rule2, voidier);
-   pthread_create(&threadRule3, NULL, rule3, voidier);
-   pthread_create(&threadMoveFlock, NULL, moveFlock, voidier);
-   pthread_create(&threadMoveBoids, NULL, updateBoids, voidier);
-   
-   // use one thread barrarier 
-   pthread_join(threadRule1, NULL);
-   pthread_join(threadRule2, NULL);
-   pthread_join(threadRule3, NULL);
-   pthread_join(threadMoveFlock, NULL);
-   pthread_join(threadMoveBoids, NULL);
+
+   // every 200 iterations change point that flock is pulled towards
+   if (flockCount % 200 == 0) {
+      flockSign = flockSign * -1;
+   }
+
+   // reset the graph and queue every task that has no inputs, the rule 2
+   // tasks go on top so the expensive work is started first
+   pthread_mutex_lock(&readyMutex);
+   donesize = 0;
+   readysize = 0;
+   for(t=0; t<tasksize; t++)
+      atomic_store(&taskArray[t].pending, taskArray[t].deps);
+   for(t=0; t<tasksize; t++)
+      if (taskArray[t].deps == 0 && taskArray[t].type != TASKRULE2)
+         readyArray[readysize++] = t;
+   for(t=0; t<tasksize; t++)
+      if (taskArray[t].type == TASKRULE2)
+         readyArray[readysize++] = t;
+   pthread_cond_broadcast(&readyCond);
+   pthread_mutex_unlock(&readyMutex);
+
+   // the main thread works too until the iteration is done
+   runTasks(1);
+
+   // the new positions become the current ones
+   swap = boidArray;
+   boidArray = boidNext;
+   boidNext = swap;
+
+   flockCount++;
 }
 
-// allocate arrays
-void allocateArrays() {
-   
+// allocate a popsize by width array
+float **allocateArray(int width) {
+
    // variables
    int i;
+   float **array;
 
-   boidArray = malloc(sizeof(float *) * popsize);
+   array = malloc(sizeof(float *) * popsize);
    for(i=0; i<popsize; i++)
-      boidArray[i] = malloc(sizeof(float) * 6);
+      array[i] = malloc(sizeof(float) * width);
 
-   boidUpdate = malloc(sizeof(float *) * popsize);
-   for(i=0; i<popsize; i++)
-      boidUpdate[i] = malloc(sizeof(float) * 3);
+   return(array);
+}
+
+// allocate arrays
+void allocateArrays() {
 
+   boidArray = allocateArray(6);
+   boidNext = allocateArray(6);
+
+   boidUpdate = allocateArray(3);
+   separationUpdate = allocateArray(3);
+   alignmentUpdate = allocateArray(3);
+   flockUpdate = allocateArray(3);
 }
 
-// allocate mutexes
-void allocateMutexes() {
+// allocate threads
+void allocateThreads() {
 
    // variables
    int i;
 
 
-   // allocate memory for the positions
-   mainMutexes = malloc(sizeof(pthread_mutex_t) * popsize);
+   pthread_mutex_init(&readyMutex, NULL);
+   pthread_cond_init(&readyCond, NULL);
+   poolQuit = 0;
+   readysize = 0;
 
-   // initilize each mutex
-   for(i = 0; i < popsize; i++)
-      pthread_mutex_init(&(mainMutexes[i]), NULL);
+   // thread 0 is the main thread
+   threadArray = malloc(sizeof(pthread_t) * threadsize);
+   for(i = 1; i < threadsize; i++)
+      pthread_create(&threadArray[i], NULL, taskWorker, NULL);
+}
 
-   
-   // allocate memory for the updates
-   updateMutexes = malloc(sizeof(pthread_mutex_t) * popsize);
+// stop the workers and wait for them to exit
+void freeThreads() {
 
-   // initilize each mutex
-   for(i = 0; i < popsize; i++)
-      pthread_mutex_init(&(updateMutexes[i]), NULL);
+   // variables
+   int i;
+
+
+   pthread_mutex_lock(&readyMutex);
+   poolQuit = 1;
+   pthread_cond_broadcast(&readyCond);
+   pthread_mutex_unlock(&readyMutex);
+
+   for(i = 1; i < threadsize; i++)
+      pthread_join(threadArray[i], NULL);
+   free(threadArray);
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 
+// print usage
+void printUsage(char *name) {
+
+   printf("USAGE: %s <-i iterations> <-c pop_size> <-t threads> <-k block_size>\n", name);
+   printf("\n");
+   printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+   printf("\n");
+   printf("   iterations -the number of times the population will be updated\n");
+   printf("\n");
+   printf("   pop_size -the number of boids to create\n");
+   printf("   the number of iterations only affects the non-curses program boidspt\n");
+   printf("   the curses program exits when q is pressed\n");
+   printf("\n");
+   printf("   threads -the number of threads running tasks, default %d\n", THREADS);
+   printf("\n");
+   printf("   block_size -the number of boids each task works on, default %d\n", BLOCKSIZE);
+   printf("\n");
+   printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+}
+
 // main function
 int main(int argc, char *argv[]) {
    
@@ -465,6 +676,15 @@ int main(int argc, char *argv[]) {
    // not used in curses version
    count = ITERATIONS;
 
+   // set the number of threads and the size of the blocks
+   threadsize = THREADS;
+   blocksize = BLOCKSIZE;
+
+   // flockSign flips on the first iteration, so the flock starts moving
+   // towards (60,60,60) as in boids.c
+   flockCount = 0;
+   flockSign = 1;
+
 
    // read command line arguments for number of iterations and
    // number of boids
@@ -477,23 +697,25 @@ int main(int argc, char *argv[]) {
          } else if (strcmp(argv[argPtr], "-c") == 0) {
             sscanf(argv[argPtr+1], "%d", &popsize);
             argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-t") == 0) {
+            sscanf(argv[argPtr+1], "%d", &threadsize);
+            argPtr += 2;
+         } else if (strcmp(argv[argPtr], "-k") == 0) {
+            sscanf(argv[argPtr+1], "%d", &blocksize);
+            argPtr += 2;
          } else {
-            printf("USAGE: %s <-i iterations> <-c pop_size> <-t threads>\n", argv[0]);
-            printf("\n");
-            printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
-            printf("\n");
-            printf("   iterations -the number of times the population will be updated\n");
-            printf("\n");
-            printf("   pop_size -the number of boids to create\n");
-            printf("   the number of iterations only affects the non-curses program boidspt\n");
-            printf("   the curses program exits when q is pressed\n");
-            printf("\n");
-            printf(" //\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\\\\//\n");
+            printUsage(argv[0]);
             exit(1);
          }
       }
    }
 
+   // a task needs at least one boid
+   if (blocksize < 1) {
+      printUsage(argv[0]);
+      exit(1);
+   }
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -501,8 +723,9 @@ int main(int argc, char *argv[]) {
    // allocate space for arrays to store boid position and velocity
    allocateArrays();
 
-   // allocate space needed for the mutexes
-   allocateMutexes();
+   // build the task graph and start the threads that run it
+   buildTasks();
+   allocateThreads();
 
 
    // intialize graphics 
@@ -542,6 +765,8 @@ int main(int argc, char *argv[]) {
    // print results
    printf("Number of iterations %d\n", count);
    printf("Number of boids %d\n", popsize);
+   printf("Number of threads %d\n", threadsize);
+   printf("Number of tasks %d in blocks of %d boids\n", tasksize, blocksize);
 
    /*** Start timing here ***/
    clock_gettime(CLOCK_MONOTONIC, &startTime);
@@ -561,6 +786,8 @@ int main(int argc, char *argv[]) {
 
 #endif
 
+   freeThreads();
+
 #ifndef NOGRAPHICS
 
    // shut down ncurses